@@ -1,22 +1,42 @@
-/* Config */
+/* Config: defaults, the values named in the README can be overridden by the configuration file */
 
-#define STATUS_TIMEOUT 10000  /* Time between status updates (ms) */
 #define NOTIFY_TIMEOUT 2000   /* Time to display notifications for (ms) */
-#define MX_STATUS_CHARS 192   /* Maximum allowed status characters for info line (all elements including alsa and udev notifications */
-#define MX_ELEMENT_CHARS 32   /* Maximum allowed characters in any status element (including separator and NULL termination character */
-#define MX_NUMBER_ELEMENTS MX_STATUS_CHARS/MX_ELEMENT_CHARS
+#define COALESCE_WINDOW 16    /* Notifications are output at most once per window (ms): a burst of udev / alsa events shows the latest values */
+
+/* Status element refresh intervals (ms). Network status is event driven (see also WIFI_STATION_INTERVAL) */
+#define TEMP_INTERVAL 2000
+#define BATTERY_INTERVAL 30000
+#define BATTERY_LOW 15            /* Charge (%) at or below which the battery is shown as [!]bat (urgent) */
+#define PROC_INTERVAL 1000        /* cpu, memory and pressure */
+#define POWER_SAMPLES 8           /* Battery power readings kept for smoothing: battery change events and BATTERY_INTERVAL ticks with a new reading */
+#define POWER_SMOOTHING 0.7       /* Weight of each older power reading relative to the next newer one */
+#define DWLB_RETRY_MIN 250        /* First retry delay (ms) if dwlb is not available; doubled on each failed retry ... */
+#define DWLB_RETRY_MAX 8000       /* ... up to this delay (ms) */
+#define COLLECTOR_THREAD 1        /* 1: slow probes (ethtool, temperature) run on a thread so they never delay notifications; 0: inline */
+#define SCHED_SLACK 50           /* Timers due within this time (ms) of each other are run together to save wakeups (late, never early) */
+#define SLEEP_RESYNC 1000        /* After a suspend longer than this (ms) every element is refreshed on resume */
+
+/* Refresh policy: the periodic refresh intervals above (temperature, battery, proc, wifi signal) are
+ * multiplied by each of these factors that applies. With the backlight off (screen blanked) no update
+ * is made at all, and everything is refreshed when it comes back on.
+ */
+#define POLICY_INTERVAL 5000      /* Power state check (ms): adapters, battery charge, backlight. The only wakeup while blanked */
+#define POLICY_BATTERY 2          /* No adapter online */
+#define POLICY_LOW_BATTERY 2      /* On battery, charge at or below BATTERY_LOW */
+#define POLICY_DIM 2              /* Backlight at or below POLICY_DIM_LEVEL */
+#define POLICY_DIM_LEVEL 10       /* Backlight (%) */
 
 /* Status info */
-#define THERMAL_ZONE "/sys/class/hwmon/hwmon" /* Path to thermal_zone<n> or hwmon<n> */
-#define THERMAL_NAME "cpu_thermal\nacpitz\nk10temp\namdgpu\n"   /* Names of the temperature input to monitor: first matched will be displayed. Each search term must end in new line '\n' character. Maximum of 9 search terms. */
+#define CLOCK_FORMAT "%d-%m-%Y %R"   /* strftime() format: clock updates every second if this shows seconds, otherwise on the minute */
+#define THERMAL_NAME "cpu_thermal\nacpitz\nk10temp\namdgpu\n"   /* hwmon names of the temperature input to monitor: of the sensors present, the first listed is displayed. Each search term must end in new line '\n' character. */
 #define TEMP_INPUT "temp1_input"    /* Filename for temperature input to monitor: only one temperature is reported */
+#define PSI_SHOW 10                 /* Pressure (% of time stalled, cpu / memory / io) at which the psi element is shown */
+#define HISTORY_SAMPLES 8           /* Readings of temperature, battery power and wifi signal kept for each (sparkline width): power of 2 */
+#define HISTORY_SHOW 0              /* Shown after each of these values: 1 sparkline of the readings, 2 their (min/avg/max), 3 both, 0 none */
 
-/* Status line only displays info for one battery defined below
+/* Batteries and adapters are found in the power_supply class (udev): the status line shows the combined
+ * charge and discharge power of all system batteries.
  */
-#define POWER_SUPPLY "/sys/class/power_supply"
-#define BATTERY_NAME "BAT1"
-#define ADAPTOR_NAME "AC"
-//#define ADAPTOR_NAME "ADP1"
 
 /**********************/
 /* alsa monitor setup */
@@ -32,42 +52,53 @@
 static char *si_alsaMonitor[]={ "Master", "PCM", "Headphone", "Speaker", NULL };
 
 /* Separator character between elements */
-static char si_separator=' ';
+#define SEPARATOR ' '
+static char si_separator=SEPARATOR;   /* Current separator: set from the configuration (separator) */
 
 /* Network
- * No setup here: Interface names discovered via getifaddrs(). Assumption:
+ * Interface names discovered via rtnetlink. Assumption:
  * ethernet device names start with 'e', wireless names start with 'w' bridge device names start with 'b'
  */
+#define WIFI_STATION_INTERVAL 30000 /* Time between nl80211 station dumps for wifi signal level (ms); connection changes are reported immediately */
+#define WIFI_STATION_TIMEOUT 1000   /* Time to wait for a station dump reply before showing the last signal level (ms) */
+#define WIFI_CQM_RSSI_THOLD -70     /* Signal level (dBm) at which the driver notifies a change (connection quality monitor) */
+#define WIFI_CQM_RSSI_HYST 3        /* Hysteresis (dB) for WIFI_CQM_RSSI_THOLD */
 
 /**********************/
 /* udev monitor setup */
 /**********************/
 
 /* Udev callback functions:
- *    int (*func)(struct udev_device *dev, char *displayInfo);
+ *    int (*func)(struct udev_device *dev, si_str *displayInfo);
  *    Only called on change event (add / remove events reported but these not called.
  *    These return -1 on error, or 0 on success.
+ *    Attributes that do not change while the device exists can be read with udevStaticAttr(dev, name): these
+ *    are cached, so each event only reads the attributes that change from sysfs.
  *    dev:           device which trigged the change event
- *    displayInfo:   information to display, limited to MX_ELEMENT_CHARS
+ *    displayInfo:   string builder to append the information to display to (strPrintf(), strCat())
  */
-static int backlightStatus(struct udev_device *dev, char *brightnessLevel) {
+static int backlightStatus(struct udev_device *dev, si_str *brightnessLevel) {
+   const char *actual=udev_device_get_sysattr_value(dev, "actual_brightness");
+   const char *max=udevStaticAttr(dev, "max_brightness");
    long value;
 
-   value=100*atol(udev_device_get_sysattr_value(dev, "actual_brightness"))/atol(udev_device_get_sysattr_value(dev, "max_brightness"));
-   snprintf(brightnessLevel, MX_ELEMENT_CHARS, "LCD: %li%%%c", value, si_separator);
+   if (actual==NULL || max==NULL || atol(max)<=0)
+      return -1;
+   value=100*atol(actual)/atol(max);
+   strPrintf(brightnessLevel, "LCD: %li%%", value);
 
    return 0;
 }
 
-static int rfKillStatus(struct udev_device *dev, char *rfkillInfo) {
+static int rfKillStatus(struct udev_device *dev, si_str *rfkillInfo) {
    int rfStatus=-1;
    const char *soft, *hard, *index, *type;
    
-   index=udev_device_get_sysattr_value(dev, "index");
-   type=udev_device_get_sysattr_value(dev, "type");
+   index=udevStaticAttr(dev, "index");
+   type=udevStaticAttr(dev, "type");
    soft=udev_device_get_sysattr_value(dev, "soft");
    hard=udev_device_get_sysattr_value(dev, "hard");
-   if (soft!=NULL || hard!=NULL) {
+   if (soft!=NULL && hard!=NULL) {
       if (soft[0]=='0' && hard[0]=='0')
          rfStatus=1;
       else
@@ -76,27 +107,45 @@ static int rfKillStatus(struct udev_device *dev, char *rfkillInfo) {
    if (rfStatus==-1)
       return -1;
 
-   snprintf(rfkillInfo, MX_ELEMENT_CHARS, "%s [rfkill index:%s]: %s%c", type, index, (rfStatus==0) ? "Off": "On", si_separator);
+   strPrintf(rfkillInfo, "%s [rfkill index:%s]: %s", type, index, (rfStatus==0) ? "Off": "On");
 
    return 0;
 }
 
-static int powerStatus(struct udev_device *dev, char *powerInfo) {
+static int powerStatus(struct udev_device *dev, si_str *powerInfo) {
    const char *udevSubsystem=udev_device_get_subsystem(dev);
+   const char *type=udevStaticAttr(dev, "type");
+   const char *online=udev_device_get_sysattr_value(dev, "online");
 
-   if (strcoll(BATTERY_NAME, udev_device_get_sysname(dev))==0) {
-      powerInfo[0]='\0'; /* battery reports periodic drops in charge. Just return here with empty powerInfo, status info will update */
+   if (type!=NULL && strcmp(type, "Battery")==0) {
+      /* battery reports periodic drops in charge: nothing to notify, the event updates the battery power model (sysDevEvent()) */
       return 0;
    }
 
-   if (strcoll(ADAPTOR_NAME, udev_device_get_sysname(dev))==0)
-      snprintf(powerInfo, MX_ELEMENT_CHARS, "%s: %s: %s%c", udevSubsystem, udev_device_get_sysname(dev), (*(udev_device_get_sysattr_value(dev, "online"))=='0') ? "Unplugged": "Plugged", si_separator);
+   if (online!=NULL)   /* Adapter */
+      strPrintf(powerInfo, "%s: %s: %s", udevSubsystem, udev_device_get_sysname(dev), (*online=='0') ? "Unplugged": "Plugged");
    else
-      snprintf(powerInfo, MX_ELEMENT_CHARS, "%s: %s: %s%c", udevSubsystem, udev_device_get_sysname(dev), udev_device_get_action(dev), si_separator);
+      strPrintf(powerInfo, "%s: %s: %s", udevSubsystem, udev_device_get_sysname(dev), udev_device_get_action(dev));
    
    return 0;
 }
 
+static int soundStatus(struct udev_device *dev, si_str *soundInfo) {
+   const char *id=udevStaticAttr(dev, "id");
+
+   if (id==NULL)   /* Not a card: reported as is */
+      return -1;
+   strPrintf(soundInfo, "sound: %s: Ready", id);   /* The mixer is attached if it was not (mixerHotplug()) */
+
+   return 0;
+}
+
+/* Only devices with this udev tag are notified, if any device has it: the udev rules in the README tag the
+ * adapters, backlights, rfkill switches and sound cards, so battery change events do not wake statusInfo.
+ * Comment out to notify all devices of the subsystems below.
+ */
+#define UDEV_TAG "statusinfo"
+
 /* Set subsystem to monitor and associated callback function for display
  */
 static si_udevActions udevActions[] = {
@@ -104,4 +153,5 @@ static si_udevActions udevActions[] = {
    { "backlight",       backlightStatus },
    { "rfkill",          rfKillStatus },
    { "power_supply",    powerStatus },
+   { "sound",           soundStatus },
 };
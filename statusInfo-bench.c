@@ -0,0 +1,1060 @@
+/* Status bar text: benchmark
+ *
+ * Replays an event trace through the refresh path of statusInfo away from real hardware, to check the
+ * caching and event driven changes for regressions and compare them. statusInfo-v7-udev.c is compiled
+ * into this file with the hardware facing calls replaced:
+ *    - batteries, adapters, the hwmon sensor and the notified udev devices live in a synthetic sysfs
+ *      tree (created in $TMPDIR, removed on exit). udev devices are fakes whose attributes are read
+ *      from the tree: one sysfs read per attribute and event, as libudev does
+ *    - udev monitors are fakes that keep the subsystem and tag filters set by sysDevScan() and
+ *      udevInit(): an event is received by the monitors whose filters match it (devices are tagged
+ *      by the udev rules of the README), then read by udevEvent() and sysDevDrain()
+ *    - the mixer is a fake whose events, read by mixerEvent(), call mixer_elem_cb() for an element
+ *      holding the volume and switch values of the trace
+ *    - rtnetlink link and address messages are built in the kernel format and read by rtnlSourceEvent()
+ *      from a datagram socket pair
+ *    - nl80211 station dump requests are answered with a reply built in the kernel format, parsed by
+ *      getWifiStats_nl_cb()
+ *    - ethtool ETHTOOL_GLINKSETTINGS ioctls are answered with the speed given in the trace
+ * /proc (cpu, memory, pressure) and the clock are the real ones. There is no sound card: a sound
+ * card removal detaches the mixer and it is not attached again (mixerHotplug()).
+ *
+ * Each trace event is handled as in the main loop: the event handler, sysDevUpdate(), notification
+ * output, then status line composition and output to a sink that only counts the bytes it is given
+ * (-j: the structured blocks). Timers do not run: each event is taken to arrive after the coalescing
+ * window and the notification of the previous one. Reported per event type: refreshes per second,
+ * bytes output and allocations (malloc(), calloc(), realloc(), also those of libnl, not those of the
+ * fakes) per refresh. Allocations are only counted with glibc, where the allocator can be wrapped.
+ *
+ * Compile with:
+ *    gcc -O2 -Wall -pthread -I/usr/include/libnl3 statusInfo-bench.c -lnl-genl-3 -lnl-3 -lX11 -ludev -lasound -o statusInfo-bench
+ *
+ * Usage: statusInfo-bench [-j] [-c config file] [--stats] [-n iterations] [trace file]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <libudev.h>
+#include <alsa/asoundlib.h>
+#include <netlink/netlink.h>
+#include <netlink/genl/genl.h>
+#include <linux/nl80211.h>
+
+/* Trace format: one event per line, '#' starts a comment. Lines before "replay" set up the devices
+ * and interfaces and are run once; the lines after it are replayed -n times and reported.
+ *    sysfs <path> <value>                            write an attribute of the synthetic sysfs tree
+ *    eth <ifname> <speed>                            ethtool link speed (Mb/s) returned for the interface
+ *    station <ifindex> <dBm>                         signal returned by the next station dumps, 0: not associated
+ *    udev <subsystem> <sysname> <action> [attr=value ...]   device event: the attributes are written first
+ *    alsa <element> <left %> <right %> <left switch> <right switch>   mixer element value change
+ *    link <ifname> <ifindex> <up | down | del>       RTM_NEWLINK / RTM_DELLINK
+ *    addr <ifindex> <add | del> <IPv4 address>       RTM_NEWADDR / RTM_DELADDR
+ *    wifi                                            the reply to the station dump in flight arrives
+ *    tick <tmp | bat | net | proc | clock | policy>  a periodic timer expires
+ */
+static const char *benchDefaultTrace =
+   "udev power_supply AC add type=Mains online=1\n"
+   "udev power_supply BAT0 add type=Battery status=Discharging capacity=81 power_now=9800000 energy_now=40100000 energy_full=52000000\n"
+   "udev hwmon hwmon0 add name=k10temp temp1_input=47000\n"
+   "udev backlight intel_backlight add max_brightness=96000 actual_brightness=48000\n"
+   "udev rfkill rfkill0 add type=wlan index=0 soft=0 hard=0\n"
+   "eth enp3s0 1000\n"
+   "station 3 -58\n"
+   "link enp3s0 2 up\n"
+   "addr 2 add 192.168.1.20\n"
+   "link wlan0 3 up\n"
+   "addr 3 add 192.168.1.21\n"
+   "wifi\n"
+   "alsa Master 40 40 1 1\n"
+   "replay\n"
+   "# Steady state: periodic timers, most see no change\n"
+   "tick proc\n"
+   "tick clock\n"
+   "tick tmp\n"
+   "sysfs class/hwmon/hwmon0/temp1_input 48000\n"
+   "tick tmp\n"
+   "tick proc\n"
+   "sysfs class/power_supply/BAT0/power_now 10400000\n"
+   "udev power_supply BAT0 change capacity=80 energy_now=39600000\n"
+   "tick bat\n"
+   "tick net\n"
+   "wifi\n"
+   "station 3 -61\n"
+   "tick net\n"
+   "wifi\n"
+   "tick proc\n"
+   "# Notification bursts: backlight key held down, volume slider dragged\n"
+   "udev backlight intel_backlight change actual_brightness=52000\n"
+   "udev backlight intel_backlight change actual_brightness=56000\n"
+   "udev backlight intel_backlight change actual_brightness=60000\n"
+   "alsa Master 50 50 1 1\n"
+   "alsa Master 55 55 1 1\n"
+   "alsa Master 60 60 1 1\n"
+   "alsa Master 60 60 0 0\n"
+   "alsa Master 60 60 1 1\n"
+   "udev rfkill rfkill0 change soft=1\n"
+   "udev rfkill rfkill0 change soft=0\n"
+   "tick proc\n"
+   "# Cable unplugged and replugged, adapter unplugged and replugged\n"
+   "link enp3s0 2 down\n"
+   "addr 2 del 192.168.1.20\n"
+   "link enp3s0 2 up\n"
+   "addr 2 add 192.168.1.20\n"
+   "udev power_supply AC change online=0\n"
+   "sysfs class/power_supply/BAT0/status Discharging\n"
+   "tick bat\n"
+   "udev power_supply AC change online=1\n"
+   "sysfs class/power_supply/BAT0/status Charging\n"
+   "tick bat\n"
+   "tick proc\n";
+
+/* Allocations: counted while a refresh is measured. glibc exports its allocator as __libc_malloc()
+ * and friends, so malloc() can be replaced by a wrapper; other C libraries have no such entry points.
+ */
+static unsigned long benchAllocs;
+static int benchCounting;
+
+#ifdef __GLIBC__
+#define BENCH_ALLOCS 1
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+void *malloc(size_t size) {
+   benchAllocs+=benchCounting;
+   return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+   benchAllocs+=benchCounting;
+   return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+   benchAllocs+=benchCounting;
+   return __libc_realloc(p, size);
+}
+#else
+#define BENCH_ALLOCS 0
+#endif
+
+/* Synthetic sysfs tree */
+#define BENCH_PATH_LEN 256
+static char benchRoot[BENCH_PATH_LEN];
+
+/* Write value to the attribute at path (relative to benchRoot), creating its directories */
+static int benchSysfsWrite(const char *path, const char *value) {
+   char full[BENCH_PATH_LEN], *p;
+   int fd, len, ret=0;
+
+   if (snprintf(full, sizeof(full), "%s/%s", benchRoot, path)>=(int)sizeof(full))
+      return -1;
+   for (p=full+strlen(benchRoot)+1; (p=strchr(p, '/'))!=NULL; p++) {
+      *p='\0';
+      if (mkdir(full, 0755)==-1 && errno!=EEXIST)
+         ret=-1;
+      *p='/';
+   }
+   fd=open(full, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);   /* Truncated in place: open handles read the new value */
+   len=strlen(value);
+   if (ret==-1 || fd<0 || write(fd, value, len)!=len || write(fd, "\n", 1)!=1)
+      ret=-1;
+   if (fd>=0)
+      close(fd);
+   if (ret==-1)
+      fprintf(stderr, "benchSysfsWrite(): %s: %s\n", full, strerror(errno));
+   return ret;
+}
+
+static int benchRemove(const char *path, const struct stat *sb, int flag, struct FTW *ftw) {
+   return remove(path);
+}
+
+/* Fake udev device: sysfs attributes are read on first use and kept for the event, as libudev does */
+#define BENCH_ATTRS 8
+struct udev_device {
+   char syspath[BENCH_PATH_LEN];
+   char subsystem[32], sysname[32], action[16];
+   int nAttrs;
+   char attrName[BENCH_ATTRS][32];
+   char attrValue[BENCH_ATTRS][64];
+};
+
+static const char *benchDevSubsystem(struct udev_device *dev) {
+   return dev->subsystem;
+}
+
+static const char *benchDevSysname(struct udev_device *dev) {
+   return dev->sysname;
+}
+
+static const char *benchDevSyspath(struct udev_device *dev) {
+   return dev->syspath;
+}
+
+static const char *benchDevAction(struct udev_device *dev) {
+   return dev->action;
+}
+
+static const char *benchDevSysattr(struct udev_device *dev, const char *name) {
+   char path[BENCH_PATH_LEN+32];
+   int i, fd;
+   ssize_t n;
+
+   for (i=0; i<dev->nAttrs; i++) {
+      if (strcmp(dev->attrName[i], name)==0)
+         return dev->attrValue[i];
+   }
+   if (dev->nAttrs>=BENCH_ATTRS)
+      return NULL;
+   snprintf(path, sizeof(path), "%s/%s", dev->syspath, name);
+   if ((fd=open(path, O_RDONLY|O_CLOEXEC))<0)
+      return NULL;
+   n=read(fd, dev->attrValue[i], sizeof(dev->attrValue[i])-1);
+   close(fd);
+   if (n<0)
+      return NULL;
+   if (n>0 && dev->attrValue[i][n-1]=='\n')
+      n--;
+   dev->attrValue[i][n]='\0';
+   snprintf(dev->attrName[i], sizeof(dev->attrName[i]), "%s", name);
+   dev->nAttrs++;
+   return dev->attrValue[i];
+}
+
+static struct udev_device *benchDevUnref(struct udev_device *dev) {
+   return NULL;   /* The trace event's device: reused */
+}
+
+/* Fake udev monitor: the filters libudev would compile into the kernel socket filter, and the device
+ * of the event being replayed if they match it
+ */
+#define BENCH_MONITORS 4
+#define BENCH_FILTERS 16
+struct udev_monitor {
+   int used, nSubsystems, tagged;
+   char subsystem[BENCH_FILTERS][32];
+   struct udev_device *pending;
+};
+static struct udev_monitor benchMonitors[BENCH_MONITORS];
+
+struct udev {
+   int unused;
+};
+static struct udev benchUdevCtx;
+
+static struct udev_monitor *benchMonNew(struct udev *udev, const char *name) {
+   int i;
+
+   for (i=0; i<BENCH_MONITORS && benchMonitors[i].used; i++)
+      ;
+   if (i==BENCH_MONITORS)
+      return NULL;
+   memset(&benchMonitors[i], 0, sizeof(benchMonitors[i]));
+   benchMonitors[i].used=1;
+   return &benchMonitors[i];
+}
+
+static int benchMonSubsystem(struct udev_monitor *mon, const char *subsystem, const char *devtype) {
+   if (mon->nSubsystems==BENCH_FILTERS)
+      return -ENOMEM;
+   snprintf(mon->subsystem[mon->nSubsystems++], sizeof(mon->subsystem[0]), "%s", subsystem);
+   return 0;
+}
+
+static int benchMonTag(struct udev_monitor *mon, const char *tag) {
+   mon->tagged=1;
+   return 0;
+}
+
+static int benchMonEnable(struct udev_monitor *mon) {
+   return 0;
+}
+
+static struct udev_monitor *benchMonUnref(struct udev_monitor *mon) {
+   if (mon!=NULL)
+      mon->used=0;
+   return NULL;
+}
+
+static int benchMonFd(struct udev_monitor *mon) {
+   return -1;   /* Not in the event loop: the handlers are called by benchDeliver() */
+}
+
+static struct udev_device *benchMonReceive(struct udev_monitor *mon) {
+   struct udev_device *dev=mon->pending;
+
+   mon->pending=NULL;
+   if (dev==NULL)
+      errno=EAGAIN;
+   return dev;
+}
+
+/* Fake enumeration: matches no device (the trace adds them), except that the tag is taken to be in
+ * use (udevTagged())
+ */
+struct udev_enumerate {
+   int tagged;
+};
+struct udev_list_entry {
+   int unused;
+};
+static struct udev_enumerate benchEnumerate;
+static struct udev_list_entry benchTaggedEntry;
+
+static struct udev_enumerate *benchEnumNew(struct udev *udev) {
+   benchEnumerate.tagged=0;
+   return &benchEnumerate;
+}
+
+static int benchEnumSubsystem(struct udev_enumerate *e, const char *subsystem) {
+   return 0;
+}
+
+static int benchEnumTag(struct udev_enumerate *e, const char *tag) {
+   e->tagged=1;
+   return 0;
+}
+
+static int benchEnumScan(struct udev_enumerate *e) {
+   return 0;
+}
+
+static struct udev_list_entry *benchEnumList(struct udev_enumerate *e) {
+   return e->tagged ? &benchTaggedEntry : NULL;
+}
+
+static struct udev_enumerate *benchEnumUnref(struct udev_enumerate *e) {
+   return NULL;
+}
+
+#define udev_device_get_subsystem benchDevSubsystem
+#define udev_device_get_sysname benchDevSysname
+#define udev_device_get_syspath benchDevSyspath
+#define udev_device_get_action benchDevAction
+#define udev_device_get_sysattr_value benchDevSysattr
+#define udev_device_unref benchDevUnref
+#define udev_monitor_new_from_netlink benchMonNew
+#define udev_monitor_filter_add_match_subsystem_devtype benchMonSubsystem
+#define udev_monitor_filter_add_match_tag benchMonTag
+#define udev_monitor_enable_receiving benchMonEnable
+#define udev_monitor_unref benchMonUnref
+#define udev_monitor_get_fd benchMonFd
+#define udev_monitor_receive_device benchMonReceive
+#define udev_enumerate_new benchEnumNew
+#define udev_enumerate_add_match_subsystem benchEnumSubsystem
+#define udev_enumerate_add_match_tag benchEnumTag
+#define udev_enumerate_scan_devices benchEnumScan
+#define udev_enumerate_get_list_entry benchEnumList
+#define udev_enumerate_unref benchEnumUnref
+
+/* Fake mixer element: a stereo playback volume (range 0 to BENCH_VOL_MAX) and switch */
+#define BENCH_VOL_MAX 87
+struct _snd_mixer_elem {
+   char name[64];
+   void *private;
+   long volume[2];
+   int active[2];
+};
+
+static void *benchElemPrivate(const snd_mixer_elem_t *elem) {
+   return elem->private;
+}
+
+static const char *benchElemName(snd_mixer_elem_t *elem) {
+   return elem->name;
+}
+
+static int benchElemHas(snd_mixer_elem_t *elem) {
+   return 1;
+}
+
+static int benchElemJoined(snd_mixer_elem_t *elem) {
+   return 0;
+}
+
+static int benchElemSwitch(snd_mixer_elem_t *elem, snd_mixer_selem_channel_id_t channel, int *value) {
+   *value=elem->active[channel==SND_MIXER_SCHN_FRONT_RIGHT];
+   return 0;
+}
+
+static int benchElemRange(snd_mixer_elem_t *elem, long *min, long *max) {
+   *min=0;
+   *max=BENCH_VOL_MAX;
+   return 0;
+}
+
+static int benchElemVolume(snd_mixer_elem_t *elem, snd_mixer_selem_channel_id_t channel, long *value) {
+   *value=elem->volume[channel==SND_MIXER_SCHN_FRONT_RIGHT];
+   return 0;
+}
+
+/* Fake mixer: each event delivers the value change of one element */
+struct _snd_mixer {
+   snd_mixer_elem_t *pending;
+};
+static snd_mixer_t benchMixer;
+
+int mixer_elem_cb(snd_mixer_elem_t *elem, unsigned int mask);
+
+static int benchMixerRevents(snd_mixer_t *mixer, struct pollfd *pfds, unsigned int nfds, unsigned short *revents) {
+   *revents=(nfds>0) ? pfds[0].revents : 0;
+   return 0;
+}
+
+static int benchMixerHandle(snd_mixer_t *mixer) {
+   if (mixer->pending!=NULL)
+      mixer_elem_cb(mixer->pending, SND_CTL_EVENT_MASK_VALUE);
+   mixer->pending=NULL;
+   return 0;
+}
+
+static int benchMixerOpen(snd_mixer_t **mixer, int mode) {
+   return -ENODEV;   /* No sound card */
+}
+
+static int benchMixerClose(snd_mixer_t *mixer) {
+   return 0;
+}
+
+#define snd_mixer_poll_descriptors_revents benchMixerRevents
+#define snd_mixer_handle_events benchMixerHandle
+#define snd_mixer_open benchMixerOpen
+#define snd_mixer_close benchMixerClose
+#define snd_mixer_elem_get_callback_private benchElemPrivate
+#define snd_mixer_selem_get_name benchElemName
+#define snd_mixer_selem_has_playback_switch benchElemHas
+#define snd_mixer_selem_has_playback_switch_joined benchElemJoined
+#define snd_mixer_selem_get_playback_switch benchElemSwitch
+#define snd_mixer_selem_has_playback_volume benchElemHas
+#define snd_mixer_selem_has_playback_volume_joined benchElemJoined
+#define snd_mixer_selem_get_playback_volume_range benchElemRange
+#define snd_mixer_selem_get_playback_volume benchElemVolume
+
+/* Ethtool: link speed of each interface, answered to SIOCETHTOOL */
+#define BENCH_ETH 8
+static struct {
+   char name[IFNAMSIZ];
+   int speed;
+} benchEth[BENCH_ETH];
+static int benchNEth;
+
+static int benchIoctl(int fd, unsigned long request, ...) {
+   struct ethtool_link_settings *req;
+   struct ifreq *ifr;
+   va_list ap;
+   int i;
+
+   va_start(ap, request);
+   ifr=va_arg(ap, struct ifreq *);
+   va_end(ap);
+   for (i=0; i<benchNEth && strncmp(benchEth[i].name, ifr->ifr_name, IFNAMSIZ)!=0; i++)
+      ;
+   if (request!=SIOCETHTOOL || i==benchNEth) {
+      errno=EOPNOTSUPP;
+      return -1;
+   }
+   req=(struct ethtool_link_settings *)ifr->ifr_data;
+   if (req->link_mode_masks_nwords==0)
+      req->link_mode_masks_nwords=-3;   /* Handshake: the kernel's bitmap size */
+   else
+      req->speed=benchEth[i].speed;
+   return 0;
+}
+
+/* nl80211: station dump requests are answered by the "wifi" event with the "station" signal */
+#define BENCH_STATIONS 8
+static struct {
+   unsigned int ifindex;
+   int signal;
+} benchStations[BENCH_STATIONS];
+static int benchNStations;
+static unsigned int benchQuery;   /* ifindex of the station dump in flight, 0 if none */
+static unsigned int benchSeq;
+
+static int benchNlSend(struct nl_sock *sk, struct nl_msg *msg) {
+   struct nlattr *ifindex=nlmsg_find_attr(nlmsg_hdr(msg), GENL_HDRLEN, NL80211_ATTR_IFINDEX);
+
+   nlmsg_hdr(msg)->nlmsg_seq=++benchSeq;
+   benchQuery=(ifindex!=NULL) ? nla_get_u32(ifindex) : 0;
+   return nlmsg_hdr(msg)->nlmsg_len;
+}
+
+static int benchNlRecv(struct nl_sock *sk, struct nl_cb *cb);   /* After si_state: below */
+static unsigned int benchIfIndex(const char *name);
+
+#define ioctl benchIoctl
+#define nl_send_auto benchNlSend
+#define nl_recvmsgs benchNlRecv
+#define if_nametoindex benchIfIndex
+#define main statusInfoMain
+#include "statusInfo-v7-udev.c"
+#undef main
+
+static si_state benchState;
+static int benchRtnlPeer=-1;   /* rtnetlink messages are sent here: st->rtnl.fd is the other end */
+
+/* The reply to the station dump in flight, as the kernel sends it: one station entry, then done */
+static int benchNlRecv(struct nl_sock *sk, struct nl_cb *cb) {
+   struct nl_msg *msg;
+   struct nlattr *info;
+   int i, counting=benchCounting;
+
+   if (benchQuery==0)
+      return 0;
+   for (i=0; i<benchNStations && benchStations[i].ifindex!=benchQuery; i++)
+      ;
+   if (i<benchNStations && benchStations[i].signal!=0) {
+      benchCounting=0;
+      msg=nlmsg_alloc();
+      if (msg!=NULL) {
+         genlmsg_put(msg, NL_AUTO_PORT, benchSeq, 1, 0, NLM_F_MULTI, NL80211_CMD_NEW_STATION, 0);
+         nla_put_u32(msg, NL80211_ATTR_IFINDEX, benchQuery);
+         info=nla_nest_start(msg, NL80211_ATTR_STA_INFO);
+         nla_put_u8(msg, NL80211_STA_INFO_SIGNAL, (uint8_t)benchStations[i].signal);
+         nla_nest_end(msg, info);
+         benchCounting=counting;
+         if (seqCheck_handler(msg, &benchState.nlData)==NL_OK)
+            getWifiStats_nl_cb(msg, &benchState.wStats);
+         benchCounting=0;
+         nlmsg_free(msg);
+      }
+      benchCounting=counting;
+   }
+   finish_handler(NULL, &benchState.nlData.wlanStatsResult);
+   benchQuery=0;
+   return 0;
+}
+
+static unsigned int benchIfIndex(const char *name) {
+   int i;
+
+   for (i=0; i<benchState.rtnl.n; i++) {
+      if (strncmp(benchState.rtnl.ifs[i].name, name, IFNAMSIZ)==0)
+         return benchState.rtnl.ifs[i].ifindex;
+   }
+   return 0;
+}
+
+/* Sink: counts the bytes the text sink would write */
+static unsigned long benchBytes;
+
+static int benchSend(const char *status) {
+   benchBytes+=strlen(status)+1;
+   return 0;
+}
+
+static int benchSendJson(unsigned int changed) {
+   int i, n=0;
+
+   for (i=0; i<blkCount; i++) {
+      if (blocks[i].shown)
+         benchBytes+=blocks[i].json.len+(n++>0);
+   }
+   benchBytes+=4;   /* "[", "],\n" */
+   return 0;
+}
+
+/* Trace */
+enum { benchSysfs, benchEthSpeed, benchStation, benchReplay, benchUdev, benchAlsa, benchLink, benchAddr, benchWifi, benchTick };
+#define BENCH_TOKENS 12
+typedef struct {
+   int type;
+   int report;    /* benchReports[] index, -1 if not a refresh */
+   int n;
+   char tok[BENCH_TOKENS][64];
+} si_benchEvent;
+
+static const struct {
+   const char *name;
+   int (*func)(si_state *st);
+} benchTicks[]={
+   { "tmp",    updateTmp },
+   { "bat",    updateBat },
+   { "net",    updateWifi },
+   { "proc",   updateProc },
+   { "clock",  updateClock },
+   { "policy", policyUpdate },
+};
+
+static const char *benchReportNames[]={ "udev", "alsa", "link", "addr", "wifi", "tick:tmp", "tick:bat", "tick:net", "tick:proc", "tick:clock", "tick:policy" };
+typedef struct {
+   unsigned long n, bytes, allocs;
+   unsigned long long ns;
+} si_benchReport;
+static si_benchReport benchReports[LENGTH(benchReportNames)];
+
+/* Parse the trace into events. Returns the number of events, -1 on error */
+static int benchParse(const char *trace, si_benchEvent **events) {
+   static const struct { const char *name; int type, args, report; } types[]={
+      { "sysfs",   benchSysfs,    2, -1 },
+      { "eth",     benchEthSpeed, 2, -1 },
+      { "station", benchStation,  2, -1 },
+      { "replay",  benchReplay,   0, -1 },
+      { "udev",    benchUdev,     3, 0 },
+      { "alsa",    benchAlsa,     5, 1 },
+      { "link",    benchLink,     3, 2 },
+      { "addr",    benchAddr,     3, 3 },
+      { "wifi",    benchWifi,     0, 4 },
+      { "tick",    benchTick,     1, 5 },
+   };
+   const char *line, *end, *p;
+   si_benchEvent *ev=NULL, *e;
+   int n=0, size=0, lineNo=1, i, len;
+
+   for (line=trace; *line!='\0'; line=(*end=='\0') ? end : end+1, lineNo++) {
+      if ((end=strchr(line, '\n'))==NULL)
+         end=line+strlen(line);
+      if (n==size) {
+         size=(size==0) ? 64 : 2*size;
+         if ((e=realloc(ev, size*sizeof(*ev)))==NULL) {
+            free(ev);
+            return -1;
+         }
+         ev=e;
+      }
+      e=&ev[n];
+      memset(e, 0, sizeof(*e));
+      for (p=line; p<end && *p!='#'; ) {
+         while (p<end && (*p==' ' || *p=='\t'))
+            p++;
+         if (p==end || *p=='#')
+            break;
+         for (len=0; p+len<end && p[len]!=' ' && p[len]!='\t'; len++)
+            ;
+         if (e->n==BENCH_TOKENS || len>=(int)sizeof(e->tok[0])) {
+            fprintf(stderr, "benchParse(): line %i: too many or too long arguments\n", lineNo);
+            free(ev);
+            return -1;
+         }
+         memcpy(e->tok[e->n++], p, len);
+         p+=len;
+      }
+      if (e->n==0)
+         continue;
+      for (i=0; i<LENGTH(types) && strcmp(types[i].name, e->tok[0])!=0; i++)
+         ;
+      if (i==LENGTH(types) || e->n<types[i].args+1) {
+         fprintf(stderr, "benchParse(): line %i: unknown event or missing arguments: %.*s\n", lineNo, (int)(end-line), line);
+         free(ev);
+         return -1;
+      }
+      e->type=types[i].type;
+      e->report=types[i].report;
+      if (e->type==benchTick) {
+         for (i=0; i<LENGTH(benchTicks) && strcmp(benchTicks[i].name, e->tok[1])!=0; i++)
+            ;
+         if (i==LENGTH(benchTicks)) {
+            fprintf(stderr, "benchParse(): line %i: unknown timer %s\n", lineNo, e->tok[1]);
+            free(ev);
+            return -1;
+         }
+         e->report+=i;
+      }
+      n++;
+   }
+   *events=ev;
+   return n;
+}
+
+static int benchLinkMsg(char *buf, const si_benchEvent *e) {
+   struct nlmsghdr *nlh=(struct nlmsghdr *)buf;
+   struct ifinfomsg *ifi=NLMSG_DATA(nlh);
+   struct rtattr *rta;
+   size_t len=strlen(e->tok[1])+1;
+
+   memset(buf, 0, NLMSG_SPACE(sizeof(*ifi))+RTA_SPACE(IFNAMSIZ));
+   nlh->nlmsg_type=(strcmp(e->tok[3], "del")==0) ? RTM_DELLINK : RTM_NEWLINK;
+   ifi->ifi_family=AF_UNSPEC;
+   ifi->ifi_index=atoi(e->tok[2]);
+   ifi->ifi_flags=IFF_UP|IFF_BROADCAST|IFF_MULTICAST;
+   if (strcmp(e->tok[3], "up")==0)
+      ifi->ifi_flags|=IFF_RUNNING;
+   rta=(struct rtattr *)(buf+NLMSG_SPACE(sizeof(*ifi)));
+   rta->rta_type=IFLA_IFNAME;
+   rta->rta_len=RTA_LENGTH(len);
+   memcpy(RTA_DATA(rta), e->tok[1], len);
+   nlh->nlmsg_len=NLMSG_SPACE(sizeof(*ifi))+RTA_SPACE(len);
+   return nlh->nlmsg_len;
+}
+
+static int benchAddrMsg(char *buf, const si_benchEvent *e) {
+   struct nlmsghdr *nlh=(struct nlmsghdr *)buf;
+   struct ifaddrmsg *ifa=NLMSG_DATA(nlh);
+   struct rtattr *rta;
+
+   memset(buf, 0, NLMSG_SPACE(sizeof(*ifa))+RTA_SPACE(4));
+   nlh->nlmsg_type=(strcmp(e->tok[2], "del")==0) ? RTM_DELADDR : RTM_NEWADDR;
+   ifa->ifa_family=AF_INET;
+   ifa->ifa_prefixlen=24;
+   ifa->ifa_index=atoi(e->tok[1]);
+   rta=(struct rtattr *)(buf+NLMSG_SPACE(sizeof(*ifa)));
+   rta->rta_type=IFA_LOCAL;
+   rta->rta_len=RTA_LENGTH(4);
+   if (inet_pton(AF_INET, e->tok[3], RTA_DATA(rta))!=1)
+      return -1;
+   nlh->nlmsg_len=NLMSG_SPACE(sizeof(*ifa))+RTA_SPACE(4);
+   return nlh->nlmsg_len;
+}
+
+/* The udev rules of the README: adapters, backlights, rfkill switches and sound cards are tagged */
+static int benchTagged(const struct udev_device *dev) {
+   char path[BENCH_PATH_LEN+8], type[16];
+   ssize_t n=0;
+   int fd;
+
+   if (strcmp(dev->subsystem, "power_supply")==0) {
+      snprintf(path, sizeof(path), "%s/type", dev->syspath);
+      if ((fd=open(path, O_RDONLY|O_CLOEXEC))>=0) {
+         n=read(fd, type, sizeof(type)-1);
+         close(fd);
+      }
+      type[(n>0) ? n : 0]='\0';
+      return strncmp(type, "Battery", 7)!=0;
+   }
+   return strcmp(dev->subsystem, "backlight")==0 || strcmp(dev->subsystem, "rfkill")==0
+         || (strcmp(dev->subsystem, "sound")==0 && strncmp(dev->sysname, "card", 4)==0);
+}
+
+/* The device is received by the monitors whose filters match it, as the kernel socket filter does */
+static void benchPost(struct udev_device *dev) {
+   struct udev_monitor *mon;
+   int i, j;
+
+   for (i=0; i<BENCH_MONITORS; i++) {
+      mon=&benchMonitors[i];
+      for (j=0; j<mon->nSubsystems && strcmp(mon->subsystem[j], dev->subsystem)!=0; j++)
+         ;
+      if (mon->used && j<mon->nSubsystems && (!mon->tagged || benchTagged(dev)))
+         mon->pending=dev;
+   }
+}
+
+/* Inputs of an event (sysfs attributes, fake devices, kernel messages): not measured.
+ * Returns 1 if the event is a refresh, 0 if not, -1 on error
+ */
+static int benchPrepare(const si_benchEvent *e, struct udev_device *dev, snd_mixer_elem_t *elem) {
+   char path[BENCH_PATH_LEN], msg[256] __attribute__((aligned(NLMSG_ALIGNTO)));
+   const char *value;
+   int i, msgLen;
+
+   switch (e->type) {
+      case benchSysfs:
+         return benchSysfsWrite(e->tok[1], e->tok[2]);
+      case benchEthSpeed:
+         for (i=0; i<benchNEth && strcmp(benchEth[i].name, e->tok[1])!=0; i++)
+            ;
+         if (i==BENCH_ETH || snprintf(benchEth[i].name, IFNAMSIZ, "%s", e->tok[1])>=IFNAMSIZ)
+            return -1;
+         benchEth[i].speed=atoi(e->tok[2]);
+         benchNEth+=(i==benchNEth);
+         return 0;
+      case benchStation:
+         for (i=0; i<benchNStations && benchStations[i].ifindex!=(unsigned int)atoi(e->tok[1]); i++)
+            ;
+         if (i==BENCH_STATIONS)
+            return -1;
+         benchStations[i].ifindex=atoi(e->tok[1]);
+         benchStations[i].signal=atoi(e->tok[2]);
+         benchNStations+=(i==benchNStations);
+         return 0;
+      case benchReplay:
+         return 0;
+      case benchUdev:
+         memset(dev, 0, sizeof(*dev));
+         if (snprintf(dev->subsystem, sizeof(dev->subsystem), "%s", e->tok[1])>=(int)sizeof(dev->subsystem)
+               || snprintf(dev->sysname, sizeof(dev->sysname), "%s", e->tok[2])>=(int)sizeof(dev->sysname)
+               || snprintf(dev->action, sizeof(dev->action), "%s", e->tok[3])>=(int)sizeof(dev->action)
+               || snprintf(dev->syspath, sizeof(dev->syspath), "%s/class/%s/%s", benchRoot, e->tok[1], e->tok[2])>=(int)sizeof(dev->syspath))
+            return -1;
+         for (i=4; i<e->n; i++) {
+            if ((value=strchr(e->tok[i], '='))==NULL)
+               return -1;
+            snprintf(path, sizeof(path), "class/%s/%s/%.*s", e->tok[1], e->tok[2], (int)(value-e->tok[i]), e->tok[i]);
+            if (benchSysfsWrite(path, value+1)==-1)
+               return -1;
+         }
+         benchPost(dev);
+         return 1;
+      case benchAlsa:
+         for (i=0; i<cfg.nAlsa && strcmp(cfg.alsaMonitor[i], e->tok[1])!=0; i++)
+            ;
+         if (i==cfg.nAlsa) {
+            fprintf(stderr, "benchPrepare(): %s is not in alsa_monitor\n", e->tok[1]);
+            return -1;
+         }
+         snprintf(elem->name, sizeof(elem->name), "%s", e->tok[1]);
+         elem->private=(void *)(intptr_t)i;
+         elem->volume[0]=atol(e->tok[2])*BENCH_VOL_MAX/100;
+         elem->volume[1]=atol(e->tok[3])*BENCH_VOL_MAX/100;
+         elem->active[0]=atoi(e->tok[4]);
+         elem->active[1]=atoi(e->tok[5]);
+         benchMixer.pending=elem;
+         return 1;
+      case benchLink:
+      case benchAddr:
+         msgLen=(e->type==benchLink) ? benchLinkMsg(msg, e) : benchAddrMsg(msg, e);
+         if (msgLen<0 || send(benchRtnlPeer, msg, msgLen, 0)!=msgLen)
+            return -1;
+         return 1;
+   }
+   return 1;
+}
+
+/* The event handler the main loop would call for the event (the sources are not in an event loop: the
+ * bench has no epoll instance). The udev monitor is only readable if its filters let the device through.
+ * Returns 1 if the status needs to be output, -1 to exit
+ */
+static int benchDeliver(si_state *st, const si_benchEvent *e) {
+   si_source src;
+
+   memset(&src, 0, sizeof(src));
+   src.fd=-1;
+   switch (e->type) {
+      case benchUdev:
+         if (st->udevMon==NULL || st->udevMon->pending==NULL)
+            return 0;
+         src.data=st->udevMon;
+         return udevEvent(st, &src, EPOLLIN);
+      case benchAlsa:
+         src.data=(void *)0;   /* Poll descriptor index */
+         return mixerEvent(st, &src, EPOLLIN);
+      case benchLink:
+      case benchAddr:
+         return rtnlSourceEvent(st, &src, EPOLLIN);
+      case benchWifi:
+         return nlQueryEvent(st, &src, EPOLLIN);
+      case benchTick:
+         return benchTicks[e->report-5].func(st);
+   }
+   return 0;
+}
+
+/* Run the events once; measured and reported if report is set. Returns -1 on error */
+static int benchRun(si_state *st, const si_benchEvent *ev, int n, int report) {
+   static struct udev_device dev;
+   static snd_mixer_elem_t elem;
+   struct timespec t0, t1;
+   unsigned long bytes, allocs;
+   int i, refresh, ret;
+
+   for (i=0; i<n; i++) {
+      arenaReset(&frame);
+      ret=benchPrepare(&ev[i], &dev, &elem);
+      if (ret<=0) {
+         if (ret==-1)
+            return -1;
+         continue;
+      }
+
+      bytes=benchBytes;
+      allocs=benchAllocs;
+      benchCounting=1;
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      refresh=st->notifying ? endNotify(st) : 0;   /* The notification of the previous event has ended */
+      ret=benchDeliver(st, &ev[i]);
+      if (ret==-1) {
+         benchCounting=0;
+         return -1;
+      }
+      refresh|=ret | sysDevUpdate(st);
+      if (st->notifyPending) {
+         ret=notifyEmit(st);
+         refresh|=(ret>0);
+      }
+      if (refresh && !policy.blanked) {
+         getStatusInfo(st);
+         if (!st->notifying)
+            sbOut(TEXT(st->statusLine));
+         if (jsonOutput)
+            jsonOut(st);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      benchCounting=0;
+
+      if (report) {
+         benchReports[ev[i].report].n++;
+         benchReports[ev[i].report].ns+=(t1.tv_sec-t0.tv_sec)*1000000000LL+t1.tv_nsec-t0.tv_nsec;
+         benchReports[ev[i].report].bytes+=benchBytes-bytes;
+         benchReports[ev[i].report].allocs+=benchAllocs-allocs;
+      }
+   }
+   return 0;
+}
+
+static void benchPrint(int iterations, int n) {
+   si_benchReport total;
+   si_benchReport *r;
+   int i;
+
+   printf("statusInfo-bench: %i iterations of %i events, %s output\n", iterations, n, jsonOutput ? "structured" : "status line");
+   printf("%-12s %10s %12s %14s %15s\n", "event", "refreshes", "refresh/s", "bytes/refresh", "allocs/refresh");
+   memset(&total, 0, sizeof(total));
+   for (i=0; i<=LENGTH(benchReports); i++) {
+      if (i<LENGTH(benchReports)) {
+         r=&benchReports[i];
+         total.n+=r->n;
+         total.ns+=r->ns;
+         total.bytes+=r->bytes;
+         total.allocs+=r->allocs;
+      }
+      else
+         r=&total;
+      if (r->n==0)
+         continue;
+      printf("%-12s %10lu %12.0f %14.1f", (i<LENGTH(benchReports)) ? benchReportNames[i] : "total", r->n,
+            (r->ns>0) ? r->n*1e9/r->ns : 0.0, (double)r->bytes/r->n);
+      if (BENCH_ALLOCS)
+         printf(" %15.2f\n", (double)r->allocs/r->n);
+      else
+         printf(" %15s\n", "-");   /* Not counted */
+   }
+}
+
+/* Read the whole trace file. Returns NULL on error */
+static char *benchRead(const char *path) {
+   char *buf=NULL, *p;
+   size_t len=0, size=0;
+   FILE *f;
+
+   if ((f=fopen(path, "r"))==NULL) {
+      perror(path);
+      return NULL;
+   }
+   do {
+      if (len+1>=size) {
+         size=(size==0) ? 4096 : 2*size;
+         if ((p=realloc(buf, size))==NULL)
+            break;
+         buf=p;
+      }
+      len+=fread(buf+len, 1, size-len-1, f);
+      buf[len]='\0';
+   } while (!feof(f) && !ferror(f));
+   if (ferror(f) || !feof(f)) {
+      fprintf(stderr, "benchRead(): %s: read error\n", path);
+      free(buf);
+      buf=NULL;
+   }
+   fclose(f);
+   return buf;
+}
+
+int main(int argc, char **argv) {
+   const char *tmpDir=getenv("TMPDIR"), *tracePath=NULL;
+   char *trace=NULL;
+   si_benchEvent *ev=NULL;
+   si_state *st=&benchState;
+   int i, n, replay, iterations=1000, ret=1, sv[2];
+
+   for (i=1; i<argc; i++) {
+      if (strcmp(argv[i], "-j")==0)
+         jsonOutput=1;
+      else if (strcmp(argv[i], "--stats")==0) {
+         statsOn=1;
+         clock_gettime(CLOCK_MONOTONIC, &statSince);
+      }
+      else if (strcmp(argv[i], "-c")==0 && i+1<argc)
+         snprintf(cfgPath, MX_PATH_LEN, "%s", argv[++i]);
+      else if (strcmp(argv[i], "-n")==0 && i+1<argc && atoi(argv[i+1])>0)
+         iterations=atoi(argv[++i]);
+      else if (argv[i][0]!='-' && tracePath==NULL)
+         tracePath=argv[i];
+      else {
+         fprintf(stderr, "Usage: %s [-j] [-c config file] [--stats] [-n iterations] [trace file]\n", argv[0]);
+         fprintf(stderr, "   Replay the trace (default: built in) through the refresh path with fake sysfs, udev, alsa, netlink and ethtool\n");
+         fprintf(stderr, "   -j    structured output (i3bar / swaybar protocol blocks) instead of the status line\n");
+         fprintf(stderr, "   -c    statusInfo configuration file (default: config.h values)\n");
+         fprintf(stderr, "   --stats  also dump the statusInfo --stats table\n");
+         fprintf(stderr, "   -n    number of times the events after \"replay\" are run (default 1000)\n");
+         return 1;
+      }
+   }
+   if (configLoad(cfgPath, 1, &cfg)==-1)
+      return 1;
+   configSet();
+   if (tracePath!=NULL && (trace=benchRead(tracePath))==NULL)
+      return 1;
+   n=benchParse((trace!=NULL) ? trace : benchDefaultTrace, &ev);
+   free(trace);
+   if (n<0)
+      return 1;
+   for (replay=0; replay<n && ev[replay].type!=benchReplay; replay++)
+      ;
+   if (replay==n)
+      replay=0;   /* No setup */
+
+   snprintf(benchRoot, sizeof(benchRoot), "%s/statusInfo-bench.XXXXXX", (tmpDir!=NULL) ? tmpDir : "/tmp");
+   if (mkdtemp(benchRoot)==NULL) {
+      perror("mkdtemp");
+      free(ev);
+      return 1;
+   }
+
+   sinks[text].send=benchSend;
+   sinks[text].sendJson=benchSendJson;
+   sinks[text].enabled=1;
+   memset(st, 0, sizeof(*st));
+   st->udevCtx=&benchUdevCtx;
+   sysDevScan(&st->devs, st->udevCtx);   /* No devices yet: the trace adds them */
+   udevOpen(st);
+   st->mixer.handle=&benchMixer;
+   st->mixer.nFds=1;
+   st->mixer.pfds[0].fd=-1;
+   if (socketpair(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC, 0, sv)==-1) {
+      perror("socketpair");
+      sv[0]=-1;
+   }
+   st->rtnl.fd=sv[0];
+   benchRtnlPeer=sv[1];
+   st->nlData.id=1;  /* nl80211 family: requests go to benchNlSend() */
+   st->nlData.stationMsg=nlmsg_alloc();
+   clockInit(&st->clock);   /* The timer is not monitored: the clock is updated by "tick clock" */
+   procInit(&st->proc);
+   endNotify(st);
+
+   if (st->nlData.stationMsg!=NULL && st->rtnl.fd>=0 && benchRun(st, ev, replay, 0)==0) {
+      for (i=0; i<iterations; i++) {
+         if (benchRun(st, ev+replay, n-replay, 1)==-1)
+            break;
+      }
+      if (i==iterations) {
+         benchPrint(iterations, n-replay);
+         ret=0;
+      }
+   }
+   if (statsOn)
+      statsDump();
+
+   if (ethCache.fd>=0)
+      close(ethCache.fd);
+   sysDevClose(&st->devs);
+   procClose(&st->proc);
+   if (st->rtnl.fd>=0) {
+      close(st->rtnl.fd);
+      close(benchRtnlPeer);
+   }
+   if (st->clock.fd>=0)
+      close(st->clock.fd);
+   nlmsg_free(st->nlData.stationMsg);
+   nftw(benchRoot, benchRemove, 16, FTW_DEPTH|FTW_PHYS);
+   free(ev);
+   return ret;
+}
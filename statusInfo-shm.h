@@ -0,0 +1,66 @@
+/* Status info shared memory snapshot
+ *
+ * statusInfo -m publishes the raw values behind the status line in $XDG_RUNTIME_DIR/statusInfo.shm
+ * (a file on the tmpfs run time directory). Consumers mmap() it read only and copy it out with
+ * si_shmRead(): the segment is protected by a sequence lock, so sampling the latest values takes no
+ * system calls and no text parsing. The layout is fixed: check version and size before use.
+ *
+ * Reader example:
+ *    int fd=open(path, O_RDONLY);
+ *    const si_shm *shm=mmap(NULL, sizeof(si_shm), PROT_READ, MAP_SHARED, fd, 0);
+ *    si_shm snap;
+ *    si_shmRead(shm, &snap);
+ */
+
+#ifndef STATUSINFO_SHM_H
+#define STATUSINFO_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define SI_SHM_FILE "statusInfo.shm"   /* In $XDG_RUNTIME_DIR */
+#define SI_SHM_VERSION 1
+#define SI_SHM_NET_IF 16
+#define SI_SHM_MIXERS 8
+
+typedef struct {
+   uint32_t ifindex;
+   char name[16];
+   int32_t speed;    /* Ethernet link speed (Mb/s), -1 if unknown or not ethernet */
+   int32_t signal;   /* Wifi signal level (dBm), 0 if unknown or not wireless */
+} si_shmNetIf;
+
+typedef struct {
+   char name[64];
+   int32_t volume[2];   /* Playback volume (%) of front left, right channels; -1 if no volume control */
+   int32_t active[2];   /* Playback switch of front left, right channels: 0 muted, 1 on, -1 if no switch */
+} si_shmMixer;
+
+typedef struct {
+   uint32_t version;    /* SI_SHM_VERSION */
+   uint32_t size;       /* sizeof(si_shm) */
+   uint32_t seq;        /* Sequence lock: odd while the writer is updating */
+   uint32_t pad;
+   int64_t updated;     /* Time of last update (CLOCK_REALTIME, ns) */
+   int64_t batCapacity; /* Battery charge (%), -1 if unknown */
+   int64_t batPowerNow; /* Battery discharge power (uW), -1 if unknown */
+   int64_t temperature; /* Temperature (m°C), -1 if unknown */
+   uint32_t nNetIf;     /* Interfaces shown in the status line */
+   uint32_t nMixers;
+   si_shmNetIf netIf[SI_SHM_NET_IF];
+   si_shmMixer mixer[SI_SHM_MIXERS];
+} si_shm;
+
+/* Copy a consistent snapshot of shm to snap: retried while the writer is updating */
+static inline void si_shmRead(const si_shm *shm, si_shm *snap) {
+   uint32_t seq;
+
+   do {
+      while ((seq=__atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE)) & 1)
+         ;
+      memcpy(snap, (const void *)shm, sizeof(*snap));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+   } while (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED)!=seq);
+}
+
+#endif
@@ -3,14 +3,14 @@
  *
  * Show standard status info:
  * Periodic update:
- *    network status (wlan signal, eth connection speed); temperature readout; battery charge %; battery discharge power usage; date and time.
+ *    network status (wlan signal, eth connection speed); cpu, memory use and pressure; temperature readout; battery charge %; battery discharge power usage; date and time.
  * Event driven notifications:
  *    Defined alsa mixer controls in config.h
  *    Defined udev subsystems  in config.h
  *
  * This version uses libnl to obtain the wifi signal level. Documentation can be found here:
  * https://github.com/thom311/libnl/releases/download/libnl3_9_0/libnl-doc-3.9.0.tar.gz
- * Network status code based on the example in linux man 3 getifaddrs and netlink code based on
+ * Network status is tracked with rtnetlink (man 7 rtnetlink) and nl80211 netlink code is based on
  * iw tool: http://git.sipsolutions.net/iw.git/
  *
  * Compile with:
@@ -19,10 +19,13 @@
  * Dr. R. Padgett <rod_padgett@hotmail.com> (c) 2024
  */
 
+#define _GNU_SOURCE  /* accept4() */
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 #include <strings.h>
 #include <sys/time.h>
@@ -33,22 +36,32 @@
 #include <sys/stat.h>
 #include <signal.h>
 #include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
 #include <errno.h>
 #include <X11/Xlib.h>
+#include <X11/Xatom.h>
 #include <pwd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include <libudev.h>
 #include <alsa/asoundlib.h>
 
 /* ethtool */
-#include <ifaddrs.h>
 #include <net/if.h>     /* For IFF flags */
 #include <sys/ioctl.h>
 #include <linux/ethtool.h>
 #include <linux/sockios.h>
 
+/* rtnetlink */
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
 /* netlink */
 #include <netlink/netlink.h>
 #include <netlink/genl/genl.h>  /* genl_connect, genlmsg_put */
@@ -59,18 +72,355 @@
 #define MX_PATH_LEN 256 /* Maximum length of any path including null termination. */
 #define LENGTH(X) (sizeof X / sizeof X[0])   /* From dwm.c: https://suckless.org/ */
 
+/* Per-frame arena and string builder. Status text is composed by appending to an si_str allocated from
+ * the frame arena: a list of chunks that is reset (not freed) at the start of each main loop iteration.
+ * Building a string is then a bump allocation, each append copies only the appended text and nothing is
+ * truncated to a fixed size. Text kept from one frame to the next (rendered elements, notifications) is
+ * copied to an si_text.
+ */
+#define ARENA_CHUNK 4096
+
+typedef struct si_chunk {
+   struct si_chunk *next;
+   size_t size, used;
+   char data[];
+} si_chunk;
+
+typedef struct {
+   si_chunk *first, *cur;
+} si_arena;
+
+typedef struct {
+   char *s;          /* NUL terminated, in the frame arena: valid until the next arenaReset() */
+   size_t len, cap;
+} si_str;
+
+typedef struct {
+   char *s;          /* NUL terminated, on the heap: NULL until first set (use TEXT()) */
+   size_t len, cap;
+} si_text;
+#define TEXT(t) (((t).s!=NULL) ? (t).s : "")
+
+static si_arena frame;
+static char strEmpty[1];   /* si_str contents if allocation fails */
+
+static void arenaReset(si_arena *a) {
+   si_chunk *c;
+
+   for (c=a->first; c!=NULL; c=c->next)
+      c->used=0;
+   a->cur=a->first;
+}
+
+static void arenaFree(si_arena *a) {
+   si_chunk *c;
+
+   while ((c=a->first)!=NULL) {
+      a->first=c->next;
+      free(c);
+   }
+   a->cur=NULL;
+}
+
+/* Returns NULL if out of memory */
+static char *arenaAlloc(si_arena *a, size_t n) {
+   si_chunk *c;
+   char *p;
+
+   while (a->cur!=NULL && a->cur->size-a->cur->used<n && a->cur->next!=NULL)
+      a->cur=a->cur->next;
+   if (a->cur==NULL || a->cur->size-a->cur->used<n) {
+      c=malloc(sizeof(si_chunk)+((n>ARENA_CHUNK) ? n : ARENA_CHUNK));
+      if (c==NULL) {
+         perror("arenaAlloc");
+         return NULL;
+      }
+      c->size=(n>ARENA_CHUNK) ? n : ARENA_CHUNK;
+      c->used=0;
+      c->next=NULL;
+      if (a->cur==NULL)
+         a->first=c;
+      else
+         a->cur->next=c;   /* cur is the last chunk */
+      a->cur=c;
+   }
+   p=a->cur->data+a->cur->used;
+   a->cur->used+=n;
+   return p;
+}
+
+/* Make room for n more characters. The last string allocated in the arena grows in place */
+static int strReserve(si_str *b, size_t n) {
+   si_chunk *c=frame.cur;
+   size_t cap;
+   char *p;
+
+   if (b->len+n+1<=b->cap)
+      return 0;
+   cap=(2*b->cap>b->len+n+1) ? 2*b->cap : b->len+n+1;
+   if (cap<64)
+      cap=64;
+   if (c!=NULL && b->cap>0 && b->s+b->cap==c->data+c->used && c->size-c->used>=cap-b->cap) {
+      c->used+=cap-b->cap;
+      b->cap=cap;
+      return 0;
+   }
+   if ((p=arenaAlloc(&frame, cap))==NULL)
+      return -1;
+   memcpy(p, b->s, b->len+1);
+   b->s=p;
+   b->cap=cap;
+   return 0;
+}
+
+static void strInit(si_str *b) {
+   b->s=strEmpty;
+   b->len=b->cap=0;
+   strReserve(b, 0);
+}
+
+static int strAppend(si_str *b, const char *s, size_t n) {
+   if (strReserve(b, n)==-1)
+      return -1;
+   memcpy(b->s+b->len, s, n);
+   b->len+=n;
+   b->s[b->len]='\0';
+   return 0;
+}
+
+static int strCat(si_str *b, const char *s) {
+   return strAppend(b, s, strlen(s));
+}
+
+static int strPrintf(si_str *b, const char *fmt, ...) {
+   va_list ap;
+   size_t avail=(b->cap>0) ? b->cap-b->len : 0;
+   int n;
+
+   va_start(ap, fmt);
+   n=vsnprintf(b->s+b->len, avail, fmt, ap);
+   va_end(ap);
+   if (n<0)
+      return -1;
+   if ((size_t)n>=avail) {   /* Did not fit: format again into the grown string */
+      if (strReserve(b, n)==-1) {
+         b->s[b->len]='\0';
+         return -1;
+      }
+      va_start(ap, fmt);
+      vsnprintf(b->s+b->len, n+1, fmt, ap);
+      va_end(ap);
+   }
+   b->len+=n;
+   return 0;
+}
+
+static int textEqual(const si_text *t, const char *s, size_t len) {
+   return t->s!=NULL && t->len==len && memcmp(t->s, s, len)==0;
+}
+
+/* Copy len characters of s to t. Returns 1 if the text changed, 0 if not, -1 if out of memory */
+static int textSet(si_text *t, const char *s, size_t len) {
+   char *p;
+
+   if (textEqual(t, s, len))
+      return 0;
+   if (t->s==NULL || len+1>t->cap) {
+      if ((p=realloc(t->s, len+1))==NULL) {
+         perror("textSet");
+         return -1;
+      }
+      t->s=p;
+      t->cap=len+1;
+   }
+   memcpy(t->s, s, len);
+   t->s[len]='\0';
+   t->len=len;
+   return 1;
+}
+
+static void textFree(si_text *t) {
+   free(t->s);
+   memset(t, 0, sizeof(*t));
+}
+
 typedef struct {
    char *subSystem;
-   int (*func)(struct udev_device *dev, char *displayInfo);   /* Callback should return a string for display */
+   int (*func)(struct udev_device *dev, si_str *displayInfo);   /* Callback should append a string for display (without separator) */
 } si_udevActions;
 
+enum { udevAdd, udevRemove, udevChange, udevOther };   /* udev actions, see udevActionId() */
+
+/* FNV-1a */
+static uint32_t strHash(const char *s) {
+   uint32_t h=2166136261u;
+
+   for (; *s!='\0'; s++)
+      h=(h ^ (unsigned char)*s)*16777619u;
+   return h;
+}
+
+/* Attributes that do not change while the device exists (max_brightness, rfkill type and index) are
+ * read from sysfs on the first event of a device only: each udev_device_get_sysattr_value() is a sysfs
+ * read on a new device. Keyed by attribute path, forgotten when the device is added or removed.
+ * Direct mapped: the path hash selects the one slot the attribute can be in, a collision replaces it.
+ */
+#define MX_UDEV_ATTRS 64   /* Power of 2 */
+typedef struct {
+   uint32_t hash;    /* strHash() of path */
+   si_text path;     /* syspath/attribute, empty if slot unused */
+   si_text value;
+} si_udevAttr;
+static si_udevAttr udevAttrs[MX_UDEV_ATTRS];
+
+static const char *udevStaticAttr(struct udev_device *dev, const char *name) {
+   si_str path;
+   const char *value;
+   uint32_t hash;
+   int slot;
+
+   strInit(&path);
+   if (strPrintf(&path, "%s/%s", udev_device_get_syspath(dev), name)==-1)
+      return udev_device_get_sysattr_value(dev, name);
+   hash=strHash(path.s);
+   slot=hash&(MX_UDEV_ATTRS-1);
+   if (udevAttrs[slot].path.len>0 && udevAttrs[slot].hash==hash && strcmp(TEXT(udevAttrs[slot].path), path.s)==0)
+      return TEXT(udevAttrs[slot].value);
+
+   value=udev_device_get_sysattr_value(dev, name);
+   if (value==NULL)
+      return NULL;
+   if (textSet(&udevAttrs[slot].path, path.s, path.len)==-1 || textSet(&udevAttrs[slot].value, value, strlen(value))==-1) {
+      udevAttrs[slot].path.len=0;
+      return value;
+   }
+   udevAttrs[slot].hash=hash;
+   return TEXT(udevAttrs[slot].value);
+}
+
+/* Forget the cached attributes of syspath, all of them if syspath is NULL */
+static void udevAttrForget(const char *syspath) {
+   size_t len=(syspath!=NULL) ? strlen(syspath) : 0;
+   int i;
+
+   for (i=0; i<MX_UDEV_ATTRS; i++) {
+      if (syspath==NULL)
+         udevAttrs[i].path.len=0;
+      else if (udevAttrs[i].path.len>len && strncmp(TEXT(udevAttrs[i].path), syspath, len)==0 && TEXT(udevAttrs[i].path)[len]=='/')
+         udevAttrs[i].path.len=0;
+   }
+}
+
 #include "config.h"
+#include "statusInfo-shm.h"
+
+/* History of a metric: the last HISTORY_SAMPLES readings in a fixed ring, with their sum for the average
+ * and two monotonic queues for the minimum and maximum, so each reading updates the aggregates in
+ * constant (amortized) time and nothing is allocated or rescanned.
+ */
+enum { historySpark=1, historyRange=2 };   /* HISTORY_SHOW, history: what is displayed */
+
+typedef struct {
+   unsigned int q[HISTORY_SAMPLES];   /* Sample numbers: the front is the extreme of the window */
+   unsigned int head, n;
+} si_historyQueue;
+
+typedef struct {
+   long v[HISTORY_SAMPLES];   /* Sample number i is v[i%HISTORY_SAMPLES] */
+   unsigned int next, n;      /* Number of the next sample, samples in the window */
+   long long sum;
+   si_historyQueue min, max;
+} si_history;
+
+static const char *sparkBars[]={ "\u2581", "\u2582", "\u2583", "\u2584", "\u2585", "\u2586", "\u2587", "\u2588" };
+
+/* Add sample i to queue q: the samples it makes irrelevant (no lower for the minimum, sign 1, or no higher
+ * for the maximum, sign -1) are dropped from the back first
+ */
+static void historyQueuePush(si_historyQueue *q, const long *v, unsigned int i, int sign) {
+   while (q->n>0 && sign*(v[q->q[(q->head+q->n-1)%HISTORY_SAMPLES]%HISTORY_SAMPLES]-v[i%HISTORY_SAMPLES])>=0)
+      q->n--;
+   q->q[(q->head+q->n++)%HISTORY_SAMPLES]=i;
+}
+
+/* Sample i leaves the window */
+static void historyQueueExpire(si_historyQueue *q, unsigned int i) {
+   if (q->n>0 && q->q[q->head]==i) {
+      q->head=(q->head+1)%HISTORY_SAMPLES;
+      q->n--;
+   }
+}
+
+static void historyAdd(si_history *h, long value) {
+   unsigned int old;
+
+   if (h->n==HISTORY_SAMPLES) {
+      old=h->next-HISTORY_SAMPLES;
+      h->sum-=h->v[old%HISTORY_SAMPLES];
+      historyQueueExpire(&h->min, old);
+      historyQueueExpire(&h->max, old);
+      h->n--;
+   }
+   h->v[h->next%HISTORY_SAMPLES]=value;
+   h->sum+=value;
+   h->n++;
+   historyQueuePush(&h->min, h->v, h->next, 1);
+   historyQueuePush(&h->max, h->v, h->next, -1);
+   h->next++;
+}
+
+#define historyMin(h) ((h)->v[(h)->min.q[(h)->min.head]%HISTORY_SAMPLES])
+#define historyMax(h) ((h)->v[(h)->max.q[(h)->max.head]%HISTORY_SAMPLES])
+
+/* Append the parts of the history selected in show: a sparkline of the window scaled from its minimum to
+ * its maximum, then "(min/avg/max)", each in units of unit (e.g. 1000 for m°C shown in °C) with decimals
+ */
+static void historyRender(si_str *b, const si_history *h, unsigned int show, double unit, int decimals) {
+   long lo, range;
+   unsigned int i;
+
+   if (h->n==0)
+      return;
+   lo=historyMin(h);
+   range=historyMax(h)-lo;
+   if (show & historySpark) {
+      for (i=h->next-h->n; i!=h->next; i++)
+         strCat(b, sparkBars[(range>0) ? (h->v[i%HISTORY_SAMPLES]-lo)*(LENGTH(sparkBars)-1)/range : 0]);
+   }
+   if (show & historyRange)
+      strPrintf(b, "(%.*f/%.*f/%.*f)", decimals, lo/unit, decimals, (double)h->sum/h->n/unit, decimals, historyMax(h)/unit);
+}
+
+/* Structured output: "_min", "_avg", "_max" fields (i3bar protocol custom keys), followed by a comma */
+static void historyJson(si_str *b, const si_history *h, double unit, int decimals) {
+   if (h->n>0)
+      strPrintf(b, "\"_min\":%.*f,\"_avg\":%.*f,\"_max\":%.*f,", decimals, historyMin(h)/unit, decimals,
+            (double)h->sum/h->n/unit, decimals, historyMax(h)/unit);
+}
+
+#define MX_NET_IF 16   /* Maximum number of interfaces tracked */
+
+typedef struct {
+   unsigned int ifindex;
+   int signal;
+   int stale;                 /* Station dump required: after (re)connect or every WIFI_STATION_INTERVAL */
+   int cqm;                   /* CQM RSSI threshold has been requested */
+   si_history history;        /* Signal levels (dBm) of the station dumps and CQM notifications */
+} si_wIf;
 
 typedef struct {
    int id;
    struct nl_sock *socket;
    struct nl_cb *wlanStats_cb;
-   int wlanStatsResult;
+   int wlanStatsResult;       /* 1 while a station dump is in flight, 0 when idle */
+   struct nl_msg *stationMsg; /* Preallocated station dump request, rebuilt for each query */
+   unsigned int querySeq;     /* Sequence number of station dump in flight */
+   struct timespec querySent;
+   struct nl_sock *evSocket;  /* Subscribed to nl80211 multicast groups: NULL if not available */
+   struct nl_cb *ev_cb;
+   int changed;               /* Set by event callback when displayed wifi status changed */
+   int n;
+   si_wIf wIfs[MX_NET_IF];    /* Signal cache per ifindex */
 } si_nlData;
 
 typedef struct {
@@ -78,9 +428,497 @@ typedef struct {
    int signal;
 } si_wStats;
 
-enum { none, xorg, text, dwlb };
+typedef struct {
+   char name[IFNAMSIZ];
+   unsigned int ifindex;
+   __s8 nwords;      /* link_mode_masks_nwords from first ETHTOOL_GLINKSETTINGS handshake; 0 if not yet done */
+} si_ethIf;
+
+typedef struct {
+   int fd;           /* Control socket for SIOCETHTOOL, kept open */
+   int n;
+   si_ethIf ifs[MX_NET_IF];
+} si_ethCache;
+
+#define MX_NET_ADDR 64   /* Maximum number of addresses tracked over all interfaces */
+#define ETH_STATUS_LEN 32   /* Ethernet status: fits any interface initial, ifindex and speed */
+
+typedef struct {
+   unsigned int ifindex;
+   char name[IFNAMSIZ];
+   unsigned int flags;        /* IFF_* flags from ifinfomsg */
+   int nAddr;                 /* Number of IPv4 / IPv6 addresses on interface */
+   int stale;                 /* displayStatus needs recomputing */
+   char displayStatus[ETH_STATUS_LEN];   /* Cached ethernet status */
+   int speed;                 /* Cached ethernet speed (Mb/s), -1 if unknown */
+} si_netIf;
+
+typedef struct {
+   unsigned int ifindex;
+   unsigned char family;
+   unsigned char prefixlen;
+   unsigned char addr[16];
+} si_netAddr;
+
+typedef struct {
+   int fd;           /* NETLINK_ROUTE socket subscribed to link and address changes */
+   __u32 seq;
+   int n, nAddrs;
+   si_netIf ifs[MX_NET_IF];
+   si_netAddr addrs[MX_NET_ADDR];
+} si_rtnl;
+
+typedef struct {
+   char path[MX_PATH_LEN];
+   int fd;           /* -1 if not open: reopened on next read */
+} si_sysAttr;
+
+/* Collector thread: slow probes and their results, see collectorInit() */
+enum { probeEth, probeEthReset, probeTmp };
+typedef struct {
+   int type;
+   unsigned int ifindex;    /* probeEth, probeEthReset (0: all interfaces) */
+   char name[IFNAMSIZ];     /* probeEth */
+   char path[MX_PATH_LEN];  /* probeTmp: TEMP_INPUT of the displayed sensor */
+   int speed;               /* probeEth result */
+   char displayStatus[ETH_STATUS_LEN];
+   long value;              /* probeTmp result (m°C), -1 on error */
+} si_probe;
+
+#define MX_PROBES 32   /* Ring size: power of 2 */
+typedef struct {
+   si_probe slot[MX_PROBES];
+   unsigned int head;      /* Written by the producer only */
+   unsigned int tail;      /* Written by the consumer only */
+} si_ring;
+
+typedef struct {
+   pthread_t thread;
+   int running;
+   int reqFd, resFd;       /* eventfds: requests queued for the thread, results queued for the main loop */
+   si_ring req, res;       /* Single producer, single consumer: main -> thread, thread -> main */
+   int resetAll;           /* Atomic: a probeEthReset was lost (ring full), reset all interfaces */
+   int ethLost;            /* Atomic: a probeEth result was lost (ring full), probe all interfaces again */
+   int quit;               /* Atomic */
+} si_collector;
+
+#define MX_SUPPLIES 8   /* Maximum number of power supplies (batteries and adapters) tracked */
+#define MX_SENSORS 16   /* Maximum number of hwmon devices tracked: all are kept, as thermal_name can be reloaded */
+
+typedef struct {
+   char syspath[MX_PATH_LEN];
+   char name[32];          /* sysname, e.g. BAT0, AC */
+   int battery;            /* 1 for a system battery, 0 for an adapter (mains, usb, ...) */
+   int charge;             /* Battery reports charge_* (uAh) rather than energy_* (uWh) */
+   long voltageMin;        /* voltage_min_design (uV), 0 if unknown: charge_full in uWh next to energy_* batteries */
+   si_sysAttr capacity, status, powerNow, currentNow, voltageNow, energyNow, energyFull;   /* energy* are charge_* if charge is set */
+   si_sysAttr online;      /* Adapter */
+} si_supply;
+
+typedef struct {
+   char syspath[MX_PATH_LEN];
+   char name[32];          /* hwmon name */
+   int rank;               /* Position of name in thermal_name: lowest is displayed, -1 if not listed */
+} si_sensor;
+
+/* Battery power model: recent power readings of all batteries, smoothed with an exponentially weighted
+ * average (newest sample weight 1, each older one POWER_SMOOTHING times less)
+ */
+typedef struct {
+   long samples[POWER_SAMPLES];  /* uW: ring buffer, newest at head */
+   int n, head;
+   int direction;    /* -1 discharging, 1 charging, 0 neither: the samples are dropped when it changes */
+   long lastRaw;     /* Reading of the newest sample: a timer tick that reads the same value adds no sample */
+   int event;        /* A battery change event arrived: the next reading is a new sample */
+} si_power;
+
+typedef struct {
+   char syspath[MX_PATH_LEN];   /* Empty if there is no backlight */
+   long max;                    /* max_brightness */
+   si_sysAttr brightness, power;   /* actual_brightness, bl_power */
+} si_backlight;
+
+typedef struct {
+   int nSupplies, nSensors;
+   si_supply supplies[MX_SUPPLIES];
+   si_power power;
+   long capacity;          /* Combined battery charge (%) at the last battery update, -1 if unknown */
+   si_sensor sensors[MX_SENSORS];
+   si_sysAttr thermal;     /* TEMP_INPUT of the displayed sensor; empty path if none */
+   int thermalChanged;     /* Another sensor was selected: its readings start a new history */
+   si_backlight backlight; /* First backlight found: input of the refresh policy */
+   int powerState;         /* An adapter or the backlight changed since the last policyUpdate() */
+   struct udev_monitor *mon;   /* power_supply, hwmon and backlight events: low priority, see sysDevDrain() */
+   struct si_source *monSrc;   /* The monitor in the event loop, only while blanked */
+} si_sysDevs;
+
+enum { psiCpu, psiMemory, psiIo, psiCount };
+
+typedef struct {
+   si_sysAttr stat, meminfo, psi[psiCount];   /* Kept open and re-read: see sysAttrRead() */
+   unsigned long long total, idle;   /* Aggregate cpu jiffies at the last tick */
+   char buf[512];    /* Only the start of each file is read: the aggregate cpu line, MemTotal..MemAvailable */
+} si_proc;
+
+enum { elNet, elCpu, elMem, elPsi, elTmp, elPwr, elBat, elClock, elCount };   /* Status elements in display order */
+#define elStatusCount elCount   /* Number of elements in the status line */
+#define EL_SEPARATED (1u<<elCpu | 1u<<elMem | 1u<<elPsi | 1u<<elTmp | 1u<<elPwr | 1u<<elBat)   /* Followed by the separator in the status line (net spaces its own interfaces) */
+enum { blkNotify=elStatusCount, blkCount };   /* Structured output blocks: the status elements, then notifications */
+
+typedef struct {
+   si_text text;
+   unsigned int version;   /* Incremented each time text changes */
+} si_element;
+enum { timerTmp, timerBat, timerNet, timerProc, timerPolicy, timerNotify, timerCoalesce, timerDwlb, timerCount };
+enum { notifyUdev=1, notifyAlsa=2 };   /* Pending notifications (si_state notifyPending) */
+
+typedef struct {
+   int fd;           /* CLOCK_REALTIME timerfd armed to the next change of the displayed time */
+   long period;      /* Seconds between changes of displayed time: 1 or 60, from CLOCK_FORMAT */
+   time_t shown;     /* Start of period currently displayed */
+} si_clock;
+
+#define MX_MIXER_FDS 8   /* Maximum number of mixer poll descriptors (alsa plugins may have several) */
+typedef struct {
+   snd_mixer_t *handle;   /* NULL if not attached: retried when a sound card appears (mixerHotplug()) */
+   int nFds;
+   struct pollfd pfds[MX_MIXER_FDS];   /* revents are set from epoll for snd_mixer_poll_descriptors_revents() */
+   struct si_source *src[MX_MIXER_FDS];
+} si_mixer;
+
+typedef struct {
+   si_sysDevs devs;
+   si_proc proc;
+   si_rtnl rtnl;
+   si_nlData nlData;
+   si_wStats wStats;
+   si_clock clock;
+   si_mixer mixer;
+   struct udev *udevCtx;
+   struct udev_monitor *udevMon;   /* Notifications of the udevActions[] enabled in the configuration */
+   struct si_source *udevSrc;
+   si_history tmpHistory, pwrHistory;  /* Temperature (m°C), battery power readings (uW) */
+   si_element element[elCount];        /* Last rendered text of each element */
+   unsigned int composed[elStatusCount];  /* Element versions in statusLine */
+   char composedSeparator;                /* si_separator in statusLine */
+   si_text statusLine;
+   si_text udevDisplayInfo[LENGTH(udevActions)+1];   /* Notification of each udevActions[] entry, then other devices */
+   si_text notifyText;   /* Notification displayed, empty if none */
+   int notifyPending;    /* notifyUdev / notifyAlsa events not output yet: see notifyEmit() */
+   int notifying;    /* A notification is displayed: status output is held until timerNotify expires */
+} si_state;
+
+typedef struct {
+   int (*func)(si_state *st);   /* Update module: returns 1 if the status needs to be output */
+   long interval;    /* Period (ms); 0 for one shot timers */
+   int scaled;       /* interval is multiplied by the refresh policy scale, and suspended while blanked */
+   int armed;
+   struct timespec due;    /* CLOCK_BOOTTIME */
+} si_timer;
+
+#define MX_SOURCES 32   /* Maximum number of fds monitored */
+typedef struct si_source {
+   int fd;           /* -1 if slot unused, -2 if removed during the current dispatch */
+   int (*func)(si_state *st, struct si_source *src, uint32_t events);   /* Returns 1 if the status needs to be output, 0 if not, -1 to exit */
+   void *data;
+} si_source;
+
+#define MX_SOCK_CLIENTS 64   /* Maximum number of socket sink subscribers */
+
+typedef struct {
+   struct sockaddr_un addr;
+   int fd;           /* Listening socket */
+   int n;
+   int clients[MX_SOCK_CLIENTS];
+} si_sockSink;
+
+typedef struct {
+   int (*send)(const char *status);   /* Returns -1 on fatal error */
+   int (*sendJson)(unsigned int changed);   /* Structured output of the blocks in the changed mask; NULL if not supported */
+   int enabled;
+} si_sink;
+
+typedef struct {
+   const char *name;
+   int batteries;          /* Instance is the names of the batteries */
+   int history;            /* 1: temperature, 2: power history fields (historyJson()) */
+   int shown;              /* full_text is not empty */
+   si_text json;
+} si_block;
+
+typedef struct {
+   struct sockaddr_un addr;
+   int fd;           /* Connection of the last message, until dwlb closes it */
+   si_source *src;
+   long backoff;     /* Current retry delay (ms): 0 if the last message was delivered */
+   char pending[4096];  /* Message not yet delivered */
+} si_dwlb;
+
+enum { xorg, text, dwlb, sock, sinkCount };   /* Output sinks: any number can be enabled */
 static Display *dpy;
-static char volumeLevel[MX_STATUS_CHARS];
+static Atom utf8String, netWmName;
+typedef struct {
+   si_text text;     /* Latest volume of the element */
+   int changed;      /* Changed since last notified */
+   int ranged;       /* min, max are valid: queried on attach and on element info change only */
+   long min, max;    /* Playback volume range */
+} si_mixerElem;
+#define MX_ALSA_ELEMS 8   /* Maximum number of mixer elements monitored */
+static si_mixerElem mixerElems[MX_ALSA_ELEMS];   /* Set by mixer_elem_cb(), same order as cfg.alsaMonitor[] */
+static si_dwlb dwlbConn = { .fd=-1 };
+static si_sockSink sockSink = { .fd=-1 };
+static si_text lastOut;   /* Last string written to the sinks */
+static int jsonOutput;   /* -j: text and socket sinks write structured blocks instead of the status line */
+static si_block blocks[blkCount] = {
+   /* name, instance, history */
+   [elNet]     = { "net" },
+   [elCpu]     = { "cpu" },
+   [elMem]     = { "memory" },
+   [elPsi]     = { "pressure" },
+   [elTmp]     = { "temperature", 0, 1 },
+   [elPwr]     = { "power",   1, 2 },
+   [elBat]     = { "battery", 1 },
+   [elClock]   = { "clock" },
+   [blkNotify] = { "notification" },
+};
+
+static si_timer timers[timerCount];
+
+/* Runtime configuration: the config.h values, overridden by the keys of the configuration file
+ * (configLoad()). Values are resolved once when loaded; on SIGHUP the file is reloaded and only
+ * the modules whose values changed are rebuilt (configApply()).
+ */
+#define MX_CFG_VALUE 64
+typedef struct {
+   long interval[timerCount];   /* Periodic timers (ms), 0 for one shot timers */
+   long notifyTimeout, coalesceWindow, wifiStationTimeout;
+   long psiShow;
+   long batteryLow, policyBattery, policyLowBattery, policyDim, policyDimLevel;
+   unsigned int history;   /* historySpark, historyRange */
+   char separator;
+   char clockFormat[MX_CFG_VALUE];
+   char thermalName[4*MX_CFG_VALUE];   /* hwmon names, each terminated by '\n' as in THERMAL_NAME */
+   char tempInput[MX_CFG_VALUE];
+   char alsaDevice[MX_CFG_VALUE];
+   int nAlsa;
+   char alsaMonitor[MX_ALSA_ELEMS][MX_CFG_VALUE];
+   unsigned int udev;   /* Bit i set: udevActions[i] is monitored */
+} si_config;
+static si_config cfg;
+static char cfgPath[MX_PATH_LEN];   /* Configuration file, empty if none */
+static int cfgRequired;   /* cfgPath was given (-c): it must exist */
+
+/* Refresh policy from the power state: see policyUpdate() */
+typedef struct {
+   int onBattery;    /* There is a battery and no adapter is online */
+   int lowBattery;   /* On battery, charge at or below battery_low */
+   int dimmed;       /* Backlight at or below policy_dim_level */
+   int blanked;      /* Backlight off: updates are suspended */
+   long scale;       /* Factor of the scaled timer intervals */
+} si_policy;
+static si_policy policy = { .scale=1 };
+
+static void schedArm(si_timer *t, long ms);
+static int policyUpdate(si_state *st);
+static int lifecycleCheck(si_state *st);
+static int sbOut(const char *status);
+static void ethInvalidate(unsigned int ifindex);
+static int collectorProbeEth(si_netIf *netIf);
+static si_ethCache ethCache = { .fd=-1 };
+static si_collector collector = { .reqFd=-1, .resFd=-1 };
+static si_source sources[MX_SOURCES];
+static int epollFd=-1;
+
+/* --stats: wall clock time (CLOCK_MONOTONIC: includes time blocked in system calls), event and syscall
+ * counts of each collector and sink, dumped on SIGUSR1 and on exit. Times are kept in log2 histograms
+ * (bucket b: up to 2^(b+1) ns), so p50 / p99 are upper bounds within a factor of 2. Counters are updated
+ * and read atomically: collectors also run on the collector thread.
+ */
+enum { statSysfs, statNet, statEth, statWifi, statMixer, statUdev, statSink, statCount=statSink+sinkCount };
+static const char *statNames[statCount]={ "sysfs+proc", "network", "ethtool", "wifi", "mixer", "udev", "sink:xorg", "sink:text", "sink:dwlb", "sink:socket" };
+#define STAT_BUCKETS 33   /* 1 ns to 8 s */
+typedef struct {
+   unsigned long events, syscalls, ns;
+   unsigned long hist[STAT_BUCKETS];
+} si_stat;
+static si_stat stats[statCount];
+static int statsOn;
+static unsigned long statWakeups;
+static struct timespec statSince;
+
+static void statStart(struct timespec *t) {
+   if (statsOn)
+      clock_gettime(CLOCK_MONOTONIC, t);
+}
+
+static void statEnd(int module, const struct timespec *t) {
+   struct timespec now;
+   unsigned long long ns;
+   int b;
+
+   if (!statsOn)
+      return;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   ns=(now.tv_sec-t->tv_sec)*1000000000ULL+now.tv_nsec-t->tv_nsec;
+   b=63-__builtin_clzll(ns|1);
+   if (b>=STAT_BUCKETS)
+      b=STAT_BUCKETS-1;
+   __atomic_fetch_add(&stats[module].events, 1, __ATOMIC_RELAXED);
+   __atomic_fetch_add(&stats[module].ns, ns, __ATOMIC_RELAXED);
+   __atomic_fetch_add(&stats[module].hist[b], 1, __ATOMIC_RELAXED);
+}
+
+static void statSyscall(int module) {
+   if (statsOn)
+      __atomic_fetch_add(&stats[module].syscalls, 1, __ATOMIC_RELAXED);
+}
+
+/* Percentile pc of module (us): upper bound of the histogram bucket */
+static double statPercentile(const si_stat *st, int pc) {
+   unsigned long n=0;
+   int b;
+
+   for (b=0; b<STAT_BUCKETS; b++) {
+      n+=st->hist[b];
+      if (n*100>=st->events*pc)
+         break;
+   }
+   return (double)(2ULL<<b)/1000;
+}
+
+static void statsDump(void) {
+   struct timespec now;
+   double minutes;
+   si_stat st;
+   int i, b;
+
+   if (!statsOn) {
+      fprintf(stderr, "statusInfo: stats not collected: run with --stats\n");
+      return;
+   }
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   minutes=((now.tv_sec-statSince.tv_sec)+(now.tv_nsec-statSince.tv_nsec)/1e9)/60;
+   fprintf(stderr, "statusInfo stats: %.1f min, %lu wakeups (%.1f/min)\n", minutes, statWakeups, (minutes>0) ? statWakeups/minutes : 0);
+   fprintf(stderr, "%-12s %10s %10s %10s %10s %12s\n", "module", "events", "syscalls", "p50(us)", "p99(us)", "wall(ms)");
+   for (i=0; i<statCount; i++) {
+      st.events=__atomic_load_n(&stats[i].events, __ATOMIC_RELAXED);
+      if (st.events==0)
+         continue;
+      st.syscalls=__atomic_load_n(&stats[i].syscalls, __ATOMIC_RELAXED);
+      st.ns=__atomic_load_n(&stats[i].ns, __ATOMIC_RELAXED);
+      for (b=0; b<STAT_BUCKETS; b++)
+         st.hist[b]=__atomic_load_n(&stats[i].hist[b], __ATOMIC_RELAXED);
+      fprintf(stderr, "%-12s %10lu %10lu %10.1f %10.1f %12.3f\n", statNames[i], st.events, st.syscalls,
+            statPercentile(&st, 50), statPercentile(&st, 99), st.ns/1e6);
+   }
+}
+
+/* Event core: modules register their fds with evAdd() and their timers in timers[] (schedArm()). The
+ * main loop waits in epoll_wait(), which returns only the ready sources, so a wakeup costs O(ready fds)
+ * however many modules there are. Sources registered edge triggered (EPOLLET) read their fd until
+ * EAGAIN; fds owned by libraries that may leave data unread (alsa, libnl, Xlib) are level triggered.
+ */
+static int evInit(void) {
+   int i;
+
+   for (i=0; i<MX_SOURCES; i++)
+      sources[i].fd=-1;
+   epollFd=epoll_create1(EPOLL_CLOEXEC);
+   if (epollFd==-1) {
+      perror("evInit: epoll_create1");
+      return -1;
+   }
+   return 0;
+}
+
+/* Monitor fd for events, calling func. Returns the source, or NULL on error (fd is not monitored) */
+static si_source *evAdd(int fd, uint32_t events, int (*func)(si_state *st, si_source *src, uint32_t events), void *data) {
+   struct epoll_event ev;
+   int i;
+
+   if (fd<0 || epollFd<0)
+      return NULL;
+   for (i=0; i<MX_SOURCES && sources[i].fd!=-1; i++)
+      ;
+   if (i==MX_SOURCES) {
+      fprintf(stderr, "evAdd: too many sources: fd %d not monitored\n", fd);
+      return NULL;
+   }
+   memset(&ev, 0, sizeof(ev));
+   ev.events=events;
+   ev.data.ptr=&sources[i];
+   if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev)==-1) {
+      perror("evAdd: epoll_ctl");
+      return NULL;
+   }
+   sources[i].fd=fd;
+   sources[i].func=func;
+   sources[i].data=data;
+   return &sources[i];
+}
+
+/* Stop monitoring, before the fd is closed. Events of the current dispatch are dropped, and the slot is
+ * only reused after it (evDispatch())
+ */
+static void evDel(si_source *src) {
+   if (src==NULL || src->fd<0)
+      return;
+   epoll_ctl(epollFd, EPOLL_CTL_DEL, src->fd, NULL);
+   src->fd=-2;
+}
+
+/* Wait for events and call the handlers of the ready sources. Returns 1 if the status needs to be
+ * output, 0 if not, -1 to exit
+ */
+static int evDispatch(si_state *st) {
+   struct epoll_event events[MX_SOURCES];
+   si_source *src;
+   int i, n, ret, refresh=0;
+
+   n=epoll_wait(epollFd, events, MX_SOURCES, -1);
+   if (n==-1) {
+      if (errno==EINTR)
+         return 0;
+      perror("evDispatch: epoll_wait");
+      return -1;
+   }
+   statWakeups++;
+   for (i=0; i<n && refresh!=-1; i++) {
+      src=events[i].data.ptr;
+      if (src->fd<0)   /* Removed by an earlier handler */
+         continue;
+      ret=src->func(st, src, events[i].events);
+      refresh=(ret==-1) ? -1 : refresh|ret;
+   }
+   for (i=0; i<MX_SOURCES; i++) {
+      if (sources[i].fd==-2)
+         sources[i].fd=-1;
+   }
+   return refresh;
+}
+
+static si_shm *shm;   /* -m: shared memory snapshot, NULL if not enabled */
+static char shmPath[MX_PATH_LEN];
+
+/* Shared memory writer: collectors write their raw values between shmBegin() and shmEnd(). shmBegin()
+ * returns NULL if the snapshot is not enabled. Readers spin while seq is odd: values are collected
+ * first, no system call is made between shmBegin() and shmEnd().
+ */
+static si_shm *shmBegin(void) {
+   if (shm==NULL)
+      return NULL;
+   __atomic_store_n(&shm->seq, shm->seq+1, __ATOMIC_RELAXED);   /* Odd: readers retry */
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+   return shm;
+}
+
+static void shmEnd(si_shm *s) {
+   struct timespec now;
+
+   clock_gettime(CLOCK_REALTIME, &now);
+   s->updated=(int64_t)now.tv_sec*1000000000+now.tv_nsec;
+   __atomic_store_n(&s->seq, s->seq+1, __ATOMIC_RELEASE);
+}
 
 static int finish_handler(struct nl_msg *msg, void *arg) {
    int *ret = arg;
@@ -88,419 +926,2747 @@ static int finish_handler(struct nl_msg *msg, void *arg) {
    return NL_SKIP;
 }
 
+/* Replaces the libnl sequence check: only replies to the station dump in flight are processed, so a
+ * reply to an abandoned query (see WIFI_STATION_TIMEOUT) can not be folded into the next one.
+ */
+static int seqCheck_handler(struct nl_msg *msg, void *arg) {
+   si_nlData *nlData=arg;
+
+   if (nlmsg_hdr(msg)->nlmsg_seq!=nlData->querySeq || nlData->wlanStatsResult==0)
+      return NL_SKIP;
+   return NL_OK;
+}
+
 static int ack_handler(struct nl_msg *msg, void *arg) {
    fprintf(stderr, "ack_handler\n");
    return NL_STOP;
 }
 
-/* Based on station.c from iw */
-static int getWifiStats_nl_cb(struct nl_msg *msg, void *arg) {
-   struct nlattr *tb[NL80211_ATTR_MAX + 1];
-   struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
-   struct nlattr *sinfo[NL80211_STA_INFO_MAX + 1];
-   struct nla_policy stats_policy[NL80211_STA_INFO_MAX + 1] = {
-             [NL80211_STA_INFO_SIGNAL]      = { .type = NLA_U8 },
-          };
+/* Based on station.c from iw */
+static int getWifiStats_nl_cb(struct nl_msg *msg, void *arg) {
+   struct nlattr *tb[NL80211_ATTR_MAX + 1];
+   struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+   struct nlattr *sinfo[NL80211_STA_INFO_MAX + 1];
+   struct nla_policy stats_policy[NL80211_STA_INFO_MAX + 1] = {
+             [NL80211_STA_INFO_SIGNAL]      = { .type = NLA_U8 },
+          };
+
+   nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+             genlmsg_attrlen(gnlh, 0), NULL);
+
+   /* This comment is retained from iw; station.c
+    * TODO: validate the interface and mac address!
+    * Otherwise, there's a race condition as soon as
+    * the kernel starts sending station notifications.
+    */
+
+   if (!tb[NL80211_ATTR_STA_INFO]) {
+     fprintf(stderr, "sta stats missing!\n");
+     return NL_SKIP;
+   }
+
+   if (nla_parse_nested(sinfo, NL80211_STA_INFO_MAX, tb[NL80211_ATTR_STA_INFO], stats_policy)) {
+     fprintf(stderr, "failed to parse nested attributes!\n");
+     return NL_SKIP;
+   }
+
+   if (sinfo[NL80211_STA_INFO_SIGNAL]) {
+     ((si_wStats*)arg)->signal = (int8_t)nla_get_u8(sinfo[NL80211_STA_INFO_SIGNAL]);
+   }
+   else
+    ((si_wStats*)arg)->signal = 0;
+
+   return NL_SKIP;
+}
+
+/* Time from a to b in ms */
+static long msElapsed(const struct timespec *a, const struct timespec *b) {
+   return (b->tv_sec-a->tv_sec)*1000+(b->tv_nsec-a->tv_nsec)/1000000;
+}
+
+static si_wIf *wifiLookup(si_nlData *nlData, unsigned int ifindex, int create) {
+   int i;
+
+   for (i=0; i<nlData->n; i++) {
+      if (nlData->wIfs[i].ifindex==ifindex)
+         return &nlData->wIfs[i];
+   }
+   if (!create || nlData->n>=MX_NET_IF)
+      return NULL;
+
+   memset(&nlData->wIfs[i], 0, sizeof(si_wIf));
+   nlData->wIfs[i].ifindex=ifindex;
+   nlData->wIfs[i].stale=1;
+   nlData->n++;
+   return &nlData->wIfs[i];
+}
+
+/* nl80211 multicast events ("mlme" and "config" groups). Connection changes mark the cached
+ * signal stale so the next refresh does a station dump; CQM RSSI notifications carry the
+ * current level on recent kernels and update the cache directly.
+ */
+static int wifiEvent_nl_cb(struct nl_msg *msg, void *arg) {
+   si_nlData *nlData=arg;
+   struct nlattr *tb[NL80211_ATTR_MAX + 1];
+   struct nlattr *cqm[NL80211_ATTR_CQM_MAX + 1];
+   struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+   si_wIf *w;
+
+   nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), NULL);
+   if (!tb[NL80211_ATTR_IFINDEX])
+      return NL_SKIP;
+   w=wifiLookup(nlData, nla_get_u32(tb[NL80211_ATTR_IFINDEX]), 0);
+   if (w==NULL)
+      return NL_SKIP;   /* Not displayed yet */
+
+   switch (gnlh->cmd) {
+      case NL80211_CMD_CONNECT:
+      case NL80211_CMD_ROAM:
+      case NL80211_CMD_ASSOCIATE:
+      case NL80211_CMD_DISCONNECT:
+      case NL80211_CMD_DISASSOCIATE:
+      case NL80211_CMD_DEAUTHENTICATE:
+         w->stale=1;
+         nlData->changed=1;
+      break;
+      case NL80211_CMD_NOTIFY_CQM:
+         if (tb[NL80211_ATTR_CQM] && nla_parse_nested(cqm, NL80211_ATTR_CQM_MAX, tb[NL80211_ATTR_CQM], NULL)==0 && cqm[NL80211_ATTR_CQM_RSSI_LEVEL]) {
+            w->signal=(int32_t)nla_get_u32(cqm[NL80211_ATTR_CQM_RSSI_LEVEL]);
+            historyAdd(&w->history, w->signal);
+         }
+         else
+            w->stale=1;
+         nlData->changed=1;
+      break;
+      case NL80211_CMD_DEL_INTERFACE:
+         *w=nlData->wIfs[--nlData->n];
+         nlData->changed=1;
+      break;
+   }
+   return NL_SKIP;
+}
+
+static int wifiEventErr_nl_cb(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg) {
+   fprintf(stderr, "nl80211 request failed: %s: signal changes reported every WIFI_STATION_INTERVAL\n", strerror(-err->error));
+   return NL_SKIP;
+}
+
+/* Ask the driver for CQM notifications when the signal crosses WIFI_CQM_RSSI_THOLD. This is sent on the
+ * non-blocking event socket, so any error reply is reported by wifiEventErr_nl_cb() without waiting here.
+ */
+static void wifiSetCqm(si_nlData *nlData, unsigned int ifindex) {
+   struct nl_msg *msg;
+   struct nlattr *cqm;
+   int r;
+
+   if (nlData->evSocket==NULL)
+      return;  /* Notifications could not be received anyway */
+   msg=nlmsg_alloc();
+   if (!msg)
+      return;
+   genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, nlData->id, 0, 0, NL80211_CMD_SET_CQM, 0);
+   nla_put_u32(msg, NL80211_ATTR_IFINDEX, ifindex);
+   cqm=nla_nest_start(msg, NL80211_ATTR_CQM);
+   nla_put_u32(msg, NL80211_ATTR_CQM_RSSI_THOLD, (uint32_t)WIFI_CQM_RSSI_THOLD);
+   nla_put_u32(msg, NL80211_ATTR_CQM_RSSI_HYST, WIFI_CQM_RSSI_HYST);
+   nla_nest_end(msg, cqm);
+   r=nl_send_auto(nlData->evSocket, msg);
+   if (r<0)
+      fprintf(stderr, "wifiSetCqm(): ifindex %u: %s\n", ifindex, nl_geterror(r));
+   nlmsg_free(msg);
+}
+
+static void init_nl80211_events(si_nlData *nlData) {
+   const char *groups[]={ NL80211_MULTICAST_GROUP_MLME, NL80211_MULTICAST_GROUP_CONFIG };
+   int i, grp;
+
+   nlData->evSocket=nl_socket_alloc();
+   if (!nlData->evSocket)
+      return;
+   if (genl_connect(nlData->evSocket))
+      goto fail;
+   nl_socket_disable_seq_check(nlData->evSocket);   /* Multicast messages are unsolicited */
+   for (i=0; i<LENGTH(groups); i++) {
+      grp=genl_ctrl_resolve_grp(nlData->socket, "nl80211", groups[i]);
+      if (grp<0 || nl_socket_add_membership(nlData->evSocket, grp)<0)
+         fprintf(stderr, "init_nl80211_events(): unable to join nl80211 group %s\n", groups[i]);
+   }
+   nlData->ev_cb=nl_cb_alloc(NL_CB_DEFAULT);
+   if (!nlData->ev_cb)
+      goto fail;
+   nl_cb_set(nlData->ev_cb, NL_CB_VALID, NL_CB_CUSTOM, wifiEvent_nl_cb, nlData);
+   nl_cb_err(nlData->ev_cb, NL_CB_CUSTOM, wifiEventErr_nl_cb, NULL);
+   nl_socket_set_nonblocking(nlData->evSocket);
+   return;
+
+fail:
+   fprintf(stderr, "init_nl80211_events(): wifi connection events won't be reported\n");
+   nl_close(nlData->evSocket);
+   nl_socket_free(nlData->evSocket);
+   nlData->evSocket=NULL;
+}
+
+/* If using ss -f netlink to view sockets created by this program, port number will not be process ID. From libnl docs:
+ * "...it was common practice to use the process identifier (PID) as the local port number. This became unpractical
+ * with the introduction of threaded netlink applications and applications requiring multiple sockets. Therefore libnl
+ * generates unique port numbers based on the process identifier and adds an offset to it allowing for multiple
+ * sockets to be used."
+ */
+static int init_nl80211(si_nlData *nlData, si_wStats *w) {
+   nlData->id=-1;
+   nlData->evSocket=NULL;
+   nlData->changed=0;
+   nlData->n=0;
+   nlData->wlanStatsResult=0;
+   nlData->stationMsg=NULL;
+   nlData->socket = nl_socket_alloc();
+   if (!nlData->socket) {
+      fprintf(stderr, "Failed to allocate netlink socket.\n");
+      return -1;
+   }
+   nl_socket_set_buffer_size(nlData->socket, 8192, 8192);
+
+   if (genl_connect(nlData->socket)) {
+      fprintf(stderr, "Failed to connect to netlink socket.\n");
+      nl_close(nlData->socket);
+      nl_socket_free(nlData->socket);
+      return -1;
+   }
+
+   nlData->id = genl_ctrl_resolve(nlData->socket, "nl80211");
+   if (nlData->id<0) {
+      fprintf(stderr, "Nl80211 interface not found.\n");
+      nl_close(nlData->socket);
+      nl_socket_free(nlData->socket);
+      return -1;
+   }
+
+   nlData->wlanStats_cb = nl_cb_alloc(NL_CB_DEFAULT);
+   if ( ! nlData->wlanStats_cb) {
+      fprintf(stderr, "Failed to allocate netlink callback.\n");
+      nl_close(nlData->socket);
+      nl_socket_free(nlData->socket);
+      return -1;
+   }
+
+   nl_cb_set(nlData->wlanStats_cb, NL_CB_VALID , NL_CB_CUSTOM, getWifiStats_nl_cb, w);
+   nl_cb_set(nlData->wlanStats_cb, NL_CB_FINISH, NL_CB_CUSTOM, finish_handler, &(nlData->wlanStatsResult));
+   nl_cb_set(nlData->wlanStats_cb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, NULL);
+   nl_cb_set(nlData->wlanStats_cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seqCheck_handler, nlData);
+
+   nlData->stationMsg = nlmsg_alloc();
+   if ( ! nlData->stationMsg) {
+      fprintf(stderr, "Failed to allocate netlink message.\n");
+      nl_cb_put(nlData->wlanStats_cb);
+      nl_close(nlData->socket);
+      nl_socket_free(nlData->socket);
+      nlData->id=-1;
+      return -1;
+   }
+
+   init_nl80211_events(nlData);  /* Uses the command socket to resolve multicast groups: do this before making it non-blocking */
+   nl_socket_set_nonblocking(nlData->socket);   /* Station dumps are driven from the main loop */
+
+   return nlData->id;
+}
+
+/* Station dump state machine: wifiQueryStart() sends the request and returns; wifiQueryRecv() is called
+ * from the main loop when the reply arrives and folds the result into the signal cache. A query
+ * that gets no reply within WIFI_STATION_TIMEOUT is abandoned and the cached (stale) value is shown.
+ */
+static int wifiQueryStart(si_nlData *nlData, si_wStats *wStats, unsigned int ifindex) {
+   struct nl_msg *msg=nlData->stationMsg;
+   int r;
+
+   nlmsg_hdr(msg)->nlmsg_len=NLMSG_HDRLEN;   /* Reuse preallocated message: truncate back to an empty header */
+   genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, nlData->id, 0, NLM_F_DUMP, NL80211_CMD_GET_STATION, 0);
+   nla_put_u32(msg, NL80211_ATTR_IFINDEX, ifindex);
+
+   wStats->ifindex=ifindex;
+   wStats->signal=0;    /* No station entries (not associated) reports 0 */
+   r=nl_send_auto(nlData->socket, msg);
+   if (r<0) {
+      fprintf(stderr, "wifiQueryStart(): %s\n", nl_geterror(r));
+      return -1;
+   }
+   nlData->querySeq=nlmsg_hdr(msg)->nlmsg_seq;
+   nlData->wlanStatsResult=1;
+   clock_gettime(CLOCK_MONOTONIC, &nlData->querySent);
+   return 0;
+}
+
+/* Returns 1 if a query completed and the displayed signal changed, otherwise 0 */
+static int wifiQueryRecv(si_nlData *nlData, si_wStats *wStats) {
+   si_wIf *w;
+   int r, inFlight=nlData->wlanStatsResult;
+
+   r=nl_recvmsgs(nlData->socket, nlData->wlanStats_cb);   /* Non-blocking: returns when no more data */
+   if (!inFlight)
+      return 0;   /* Late reply to an abandoned query */
+   if (nlData->wlanStatsResult>0) {
+      if (r>=0)
+         return 0;   /* Dump not finished yet */
+      fprintf(stderr, "wifiQueryRecv(): ifindex %u: %s\n", wStats->ifindex, nl_geterror(r));
+      nlData->wlanStatsResult=0;
+      return 0;
+   }
+
+   r=0;
+   w=wifiLookup(nlData, wStats->ifindex, 0);
+   if (w!=NULL) {
+      r=(w->signal!=wStats->signal || (cfg.history && wStats->signal!=0));   /* New reading of the history */
+      w->signal=wStats->signal;
+      w->stale=0;
+      if (w->signal!=0)
+         historyAdd(&w->history, w->signal);
+   }
+
+   /* Only one dump can be in flight: start the next stale interface, if any */
+   for (w=nlData->wIfs; w<nlData->wIfs+nlData->n; w++) {
+      if (w->stale) {
+         wifiQueryStart(nlData, wStats, w->ifindex);
+         break;
+      }
+   }
+   return r;
+}
+
+/* Cached signal for ifindex: a station dump is started when the cache is stale; the result is
+ * shown when it arrives.
+ */
+static int getWifiSignal(si_nlData *nlData, si_wStats *wStats, unsigned int ifindex) {
+   struct timespec now;
+   si_wIf *w;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   if (nlData->wlanStatsResult>0 && msElapsed(&nlData->querySent, &now) >= cfg.wifiStationTimeout) {
+      fprintf(stderr, "getWifiSignal(): no station reply for ifindex %u: showing last value\n", wStats->ifindex);
+      nlData->wlanStatsResult=0;   /* Abandon: a late reply is dropped by seqCheck_handler() */
+   }
+
+   w=wifiLookup(nlData, ifindex, 1);
+   if (w==NULL)
+      return 0;
+   if (!w->cqm) {
+      wifiSetCqm(nlData, ifindex);  /* First time this interface is seen */
+      w->cqm=1;
+   }
+
+   if (nlData->wlanStatsResult==0 && w->stale)
+      wifiQueryStart(nlData, wStats, ifindex);
+
+   return w->signal;
+}
+
+/* Ethtool: notes in /usr/include/linux/ethtool.h
+ * Also see ethtool.c do_ioctl_glinksettings().
+ * ifr struct in man 7 netdevice
+ * Note: ETHTOOL_GSET is depreciated. Use ETHTOOL_GLINKSETTINGS.
+ *
+ * One control socket is kept open for all SIOCETHTOOL requests and the ifindex and
+ * link_mode_masks_nwords from the first handshake are cached per interface, so a refresh
+ * costs a single ETHTOOL_GLINKSETTINGS ioctl per interface. ethCacheInvalidate() drops
+ * the cached state when a link changes.
+ */
+static si_ethIf *ethCacheLookup(const char *name) {
+   int i;
+
+   for (i=0; i<ethCache.n; i++) {
+      if (strncmp(ethCache.ifs[i].name, name, IFNAMSIZ)==0)
+         return &ethCache.ifs[i];
+   }
+   if (ethCache.n>=MX_NET_IF)
+      return NULL;
+
+   memset(&ethCache.ifs[i], 0, sizeof(si_ethIf));
+   strncpy(ethCache.ifs[i].name, name, IFNAMSIZ);
+   ethCache.ifs[i].name[IFNAMSIZ-1]='\0';
+   ethCache.ifs[i].ifindex=if_nametoindex(name);
+   ethCache.n++;
+   return &ethCache.ifs[i];
+}
+
+/* Drop cached state for ifindex, or for all interfaces if ifindex is 0 */
+static void ethCacheInvalidate(unsigned int ifindex) {
+   int i;
+
+   for (i=0; i<ethCache.n; i++) {
+      if (ifindex==0 || ethCache.ifs[i].ifindex==ifindex) {
+         ethCache.ifs[i]=ethCache.ifs[ethCache.n-1];
+         ethCache.n--;
+         i--;
+      }
+   }
+}
+
+/* Returns link speed (Mb/s), or -1 if unknown */
+static int getEthernetStatus(char *name, char *displayStatus) {
+   struct ifreq ifr;
+   struct {
+      struct ethtool_link_settings req;
+      __u32 link_mode_data[3*SCHAR_MAX];   /* Store for 3x link mode bitmaps (supported, advertising, lp_advertising) - not used here. In ethtool.c size is (3 x ETHTOOL_LINK_MODE_MASK_MAX_KERNEL_NU32); ethtool internal.h defines ETHTOOL_LINK_MODE_MASK_MAX_KERNEL_NU32 as SCHAR_MAX on linux. SCHAR_MAX is defined in limits.h */
+   } ecmd;
+   si_ethIf *eth;
+
+   if (ethCache.fd<0) {
+      statSyscall(statEth);
+      ethCache.fd=socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+      if (ethCache.fd==-1) {
+         displayStatus[0]='\0';
+         perror("getEthernetStatus()");
+         return -1;
+      }
+   }
+   eth=ethCacheLookup(name);
+   if (eth==NULL) {
+      displayStatus[0]='\0';
+      return -1;
+   }
+
+   memset(&ifr, 0, sizeof(ifr));
+   strncpy(ifr.ifr_name, name, IFNAMSIZ); /* Set name of interface we are interested in */
+   ifr.ifr_name[IFNAMSIZ-1]='\0';
+   ifr.ifr_data = (void*)&ecmd;
+
+   if (eth->nwords==0) {
+      memset(&ecmd, 0, sizeof(ecmd));        /* Set all fields of ecmd.req to zero */
+      ecmd.req.cmd = ETHTOOL_GLINKSETTINGS;  /* Set required command */
+      statSyscall(statEth);
+      if (ioctl(ethCache.fd, SIOCETHTOOL, &ifr) == -1) {    /* Send all fields zero except cmd to request link mode data size from kernel */
+         snprintf(displayStatus, ETH_STATUS_LEN, "%c(%i):err", name[0], eth->ifindex);
+         fprintf(stderr, "%s (index %i):", ifr.ifr_name, eth->ifindex);
+         perror("getEthernetStatus()");
+         ethCacheInvalidate(eth->ifindex);
+         return -1;
+      }
+      if (ecmd.req.link_mode_masks_nwords >= 0) {  /* Field returned negative to indicate requested size (i.e. 0) unsupported; absolute value is the supported size */
+         displayStatus[0]='\0';
+         return -1;
+      }
+      eth->nwords = -ecmd.req.link_mode_masks_nwords;
+   }
+
+   memset(&ecmd.req, 0, sizeof(ecmd.req));
+   ecmd.req.cmd = ETHTOOL_GLINKSETTINGS;     /* Now get the real data using cached link_mode_masks_nwords size */
+   ecmd.req.link_mode_masks_nwords = eth->nwords;
+   statSyscall(statEth);
+   if (ioctl(ethCache.fd, SIOCETHTOOL, &ifr) != -1) {
+      snprintf(displayStatus, ETH_STATUS_LEN, "%c%i:%iM ", name[0], eth->ifindex, ecmd.req.speed);
+      return (ecmd.req.speed==(__u32)SPEED_UNKNOWN) ? -1 : (int)ecmd.req.speed;
+   }
+   snprintf(displayStatus, ETH_STATUS_LEN, "%c(%i):err", name[0], eth->ifindex);
+   fprintf(stderr, "%s (index %i):", ifr.ifr_name, eth->ifindex);
+   perror("getEthernetStatus()");
+   ethCacheInvalidate(eth->ifindex);   /* Redo the handshake next time */
+   return -1;
+}
+
+/* rtnetlink: interface table keyed by ifindex, kept current from RTMGRP_LINK and
+ * RTMGRP_IPV4_IFADDR / RTMGRP_IPV6_IFADDR multicast messages. The table is filled by a
+ * link and address dump at startup (and after a socket overrun) and is then only updated
+ * incrementally, so the network element is only recomputed when something changes.
+ * ifi_flags are defined in: man 7 netdevice; messages in man 7 rtnetlink
+ */
+static si_netIf *rtnlIfLookup(si_rtnl *rtnl, unsigned int ifindex, int create) {
+   int i;
+
+   for (i=0; i<rtnl->n; i++) {
+      if (rtnl->ifs[i].ifindex==ifindex)
+         return &rtnl->ifs[i];
+   }
+   if (!create || rtnl->n>=MX_NET_IF)
+      return NULL;
+
+   memset(&rtnl->ifs[i], 0, sizeof(si_netIf));
+   rtnl->ifs[i].ifindex=ifindex;
+   rtnl->ifs[i].stale=1;
+   rtnl->n++;
+   return &rtnl->ifs[i];
+}
+
+/* Returns 1 if the interface table changed, otherwise 0 */
+static int rtnlLink(si_rtnl *rtnl, struct nlmsghdr *nlh) {
+   struct ifinfomsg *ifi=NLMSG_DATA(nlh);
+   int len=IFLA_PAYLOAD(nlh);
+   struct rtattr *rta;
+   const char *name=NULL;
+   si_netIf *netIf;
+   int i;
+
+   if (ifi->ifi_family==AF_BRIDGE)  /* Bridge port notifications: RTM_DELLINK here does not mean the link went away */
+      return 0;
+
+   for (rta=IFLA_RTA(ifi); RTA_OK(rta, len); rta=RTA_NEXT(rta, len)) {
+      if (rta->rta_type==IFLA_IFNAME)
+         name=RTA_DATA(rta);
+   }
+
+   if (nlh->nlmsg_type==RTM_DELLINK) {
+      netIf=rtnlIfLookup(rtnl, ifi->ifi_index, 0);
+      if (netIf==NULL)
+         return 0;
+      for (i=0; i<rtnl->nAddrs; i++) {
+         if (rtnl->addrs[i].ifindex==netIf->ifindex)
+            rtnl->addrs[i--]=rtnl->addrs[--rtnl->nAddrs];
+      }
+      ethInvalidate(netIf->ifindex);
+      *netIf=rtnl->ifs[--rtnl->n];
+      return 1;
+   }
+
+   netIf=rtnlIfLookup(rtnl, ifi->ifi_index, 1);
+   if (netIf==NULL)
+      return 0;
+   if (netIf->flags==ifi->ifi_flags && (name==NULL || strncmp(netIf->name, name, IFNAMSIZ)==0))
+      return 0;   /* e.g. wireless events: nothing we display has changed */
+
+   netIf->flags=ifi->ifi_flags;
+   if (name!=NULL) {
+      strncpy(netIf->name, name, IFNAMSIZ);
+      netIf->name[IFNAMSIZ-1]='\0';
+   }
+   netIf->stale=1;
+   ethInvalidate(netIf->ifindex);   /* Speed may have been renegotiated */
+   return 1;
+}
+
+/* Returns 1 if the interface table changed, otherwise 0 */
+static int rtnlAddr(si_rtnl *rtnl, struct nlmsghdr *nlh) {
+   struct ifaddrmsg *ifa=NLMSG_DATA(nlh);
+   int len=IFA_PAYLOAD(nlh);
+   struct rtattr *rta;
+   si_netAddr key;
+   si_netIf *netIf;
+   int i, addrLen=0;
+   void *addr=NULL;
+
+   if (ifa->ifa_family!=AF_INET && ifa->ifa_family!=AF_INET6)
+      return 0;
+
+   for (rta=IFA_RTA(ifa); RTA_OK(rta, len); rta=RTA_NEXT(rta, len)) {
+      if (rta->rta_type==IFA_LOCAL || (rta->rta_type==IFA_ADDRESS && addr==NULL)) {  /* IFA_ADDRESS is the peer on point to point links */
+         addr=RTA_DATA(rta);
+         addrLen=RTA_PAYLOAD(rta);
+      }
+   }
+   if (addr==NULL)
+      return 0;
+
+   memset(&key, 0, sizeof(key));
+   key.ifindex=ifa->ifa_index;
+   key.family=ifa->ifa_family;
+   key.prefixlen=ifa->ifa_prefixlen;
+   memcpy(key.addr, addr, addrLen>16 ? 16 : addrLen);
+
+   for (i=0; i<rtnl->nAddrs; i++) {
+      if (memcmp(&rtnl->addrs[i], &key, sizeof(key))==0)
+         break;
+   }
+   netIf=rtnlIfLookup(rtnl, key.ifindex, 0);
+
+   if (nlh->nlmsg_type==RTM_DELADDR) {
+      if (i==rtnl->nAddrs)
+         return 0;
+      rtnl->addrs[i]=rtnl->addrs[--rtnl->nAddrs];
+      if (netIf!=NULL && --netIf->nAddr==0)
+         return 1;
+      return 0;
+   }
+
+   if (i<rtnl->nAddrs || rtnl->nAddrs>=MX_NET_ADDR)
+      return 0;   /* Lifetime / flag update of known address, or table full */
+   rtnl->addrs[rtnl->nAddrs++]=key;
+   if (netIf!=NULL && netIf->nAddr++==0)
+      return 1;
+   return 0;
+}
+
+/* Returns 1 if the interface table changed, 0 if not, -1 on error. *done is set on end of dump */
+static int rtnlParse(si_rtnl *rtnl, char *buf, int len, int *done) {
+   struct nlmsghdr *nlh;
+   int changed=0;
+
+   for (nlh=(struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh=NLMSG_NEXT(nlh, len)) {
+      switch (nlh->nlmsg_type) {
+         case NLMSG_DONE:
+            if (nlh->nlmsg_seq==rtnl->seq)
+               *done=1;
+         break;
+         case NLMSG_ERROR:
+            if (nlh->nlmsg_seq==rtnl->seq) {
+               fprintf(stderr, "rtnlParse(): netlink error %i\n", ((struct nlmsgerr *)NLMSG_DATA(nlh))->error);
+               *done=1;
+               return -1;
+            }
+         break;
+         case RTM_NEWLINK:
+         case RTM_DELLINK:
+            changed|=rtnlLink(rtnl, nlh);
+         break;
+         case RTM_NEWADDR:
+         case RTM_DELADDR:
+            changed|=rtnlAddr(rtnl, nlh);
+         break;
+      }
+   }
+   return changed;
+}
+
+/* Blocking dump of links (RTM_GETLINK) or addresses (RTM_GETADDR) into the interface table */
+static int rtnlDump(si_rtnl *rtnl, int type) {
+   char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+   struct {
+      struct nlmsghdr nlh;
+      struct rtgenmsg g;
+   } req;
+   int n, done=0;
+
+   memset(&req, 0, sizeof(req));
+   req.nlh.nlmsg_len=NLMSG_LENGTH(sizeof(struct rtgenmsg));
+   req.nlh.nlmsg_type=type;
+   req.nlh.nlmsg_flags=NLM_F_REQUEST|NLM_F_DUMP;
+   req.nlh.nlmsg_seq=++rtnl->seq;
+   req.g.rtgen_family=AF_UNSPEC;
+   if (send(rtnl->fd, &req, req.nlh.nlmsg_len, 0)==-1) {
+      perror("rtnlDump(): send");
+      return -1;
+   }
+
+   while (!done) {
+      n=recv(rtnl->fd, buf, sizeof(buf), 0);
+      if (n==-1) {
+         if (errno==EINTR)
+            continue;
+         perror("rtnlDump(): recv");
+         return -1;
+      }
+      if (rtnlParse(rtnl, buf, n, &done)==-1)
+         return -1;
+   }
+   return 0;
+}
+
+static int rtnlResync(si_rtnl *rtnl) {
+   rtnl->n=0;
+   rtnl->nAddrs=0;
+   ethInvalidate(0);
+   if (rtnlDump(rtnl, RTM_GETLINK)==-1 || rtnlDump(rtnl, RTM_GETADDR)==-1)
+      return -1;
+   return 0;
+}
+
+static int rtnlInit(si_rtnl *rtnl) {
+   struct sockaddr_nl snl;
+
+   rtnl->n=0;
+   rtnl->nAddrs=0;
+   rtnl->seq=0;
+   rtnl->fd=socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_ROUTE);
+   if (rtnl->fd==-1) {
+      perror("rtnlInit(): socket");
+      return -1;
+   }
+
+   memset(&snl, 0, sizeof(snl));
+   snl.nl_family=AF_NETLINK;
+   snl.nl_groups=RTMGRP_LINK|RTMGRP_IPV4_IFADDR|RTMGRP_IPV6_IFADDR;
+   if (bind(rtnl->fd, (struct sockaddr *)&snl, sizeof(snl))==-1 || rtnlResync(rtnl)==-1) {
+      perror("rtnlInit()");
+      close(rtnl->fd);
+      rtnl->fd=-1;
+      return -1;
+   }
+   return 0;
+}
+
+/* Read pending rtnetlink messages. Returns 1 if the interface table changed, 0 if not, -1 on error */
+static int rtnlEvent(si_rtnl *rtnl) {
+   char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+   int n, r, done=0, changed=0;
+
+   for (;;) {
+      n=recv(rtnl->fd, buf, sizeof(buf), MSG_DONTWAIT);
+      if (n==-1) {
+         if (errno==EAGAIN || errno==EWOULDBLOCK)
+            break;
+         if (errno==EINTR)
+            continue;
+         if (errno==ENOBUFS) {   /* Socket overrun: events lost, so rebuild the table */
+            fprintf(stderr, "rtnlEvent(): netlink overrun: resyncing\n");
+            if (rtnlResync(rtnl)==-1)
+               return -1;
+            changed=1;
+            continue;
+         }
+         perror("rtnlEvent(): recv");
+         return -1;
+      }
+      r=rtnlParse(rtnl, buf, n, &done);
+      if (r>0)
+         changed=1;
+   }
+   return changed;
+}
+
+/* Display assumes 'e' for ethernet, 'b' for bridge interfaces, 'w' for wireless */
+static void getNetwork(si_str *displayText, si_rtnl *rtnl, si_nlData *nlData, si_wStats *wStats) {
+   struct timespec tn, t;   /* --stats: whole network element, ethtool and wifi probes */
+   int j, signal;
+   si_netIf *netIf;
+   si_wIf *w;
+   si_shm *s;
+   si_shmNetIf shmIfs[SI_SHM_NET_IF], *shmIf;   /* Published at the end: no syscalls inside the seqlock */
+   unsigned int nShmIfs=0;
+
+   statStart(&tn);
+   for (j=0; j<rtnl->n; j++) {
+      netIf=&rtnl->ifs[j];
+      if (netIf->flags&IFF_LOOPBACK || netIf->flags&IFF_POINTOPOINT || !(netIf->flags&IFF_RUNNING) || netIf->nAddr==0)
+         continue;
+
+      signal=0;
+      if (netIf->name[0]=='e' || netIf->name[0]=='b') {
+         if (netIf->stale) {   /* On the collector thread if running: the last status is shown until it replies */
+            if (collectorProbeEth(netIf)==0)
+               netIf->stale=0;
+            else if (!collector.running) {
+               statStart(&t);
+               netIf->speed=getEthernetStatus(netIf->name, netIf->displayStatus);
+               statEnd(statEth, &t);
+               netIf->stale=0;
+            }
+            /* Request ring full: the thread owns ethCache, retried on the next refresh */
+         }
+         strCat(displayText, netIf->displayStatus);
+      }
+      if (netIf->name[0]=='w' && nlData->id>=0) {
+         statStart(&t);
+         signal=getWifiSignal(nlData, wStats, netIf->ifindex);
+         statEnd(statWifi, &t);
+         strPrintf(displayText, "w%i:%ddBm", netIf->ifindex, signal);
+         if ((w=wifiLookup(nlData, netIf->ifindex, 0))!=NULL)
+            historyRender(displayText, &w->history, cfg.history, 1, 0);
+         strCat(displayText, " ");
+      }
+
+      if (shm!=NULL && nShmIfs<SI_SHM_NET_IF) {
+         shmIf=&shmIfs[nShmIfs++];
+         shmIf->ifindex=netIf->ifindex;
+         memcpy(shmIf->name, netIf->name, sizeof(shmIf->name));
+         shmIf->speed=(netIf->name[0]=='e' || netIf->name[0]=='b') ? netIf->speed : -1;
+         shmIf->signal=signal;
+      }
+   }
+   if ((s=shmBegin())!=NULL) {
+      memcpy(s->netIf, shmIfs, nShmIfs*sizeof(si_shmNetIf));
+      s->nNetIf=nShmIfs;
+      shmEnd(s);
+   }
+   statEnd(statNet, &tn);
+}
+
+/* Xorg output: the root window name is set with XChangeProperty() and only flushed, so an update
+ * never waits for a round trip to the X server. Errors are reported asynchronously: they are read
+ * (and logged by xorgError()) when the X connection, which is monitored by the main loop, is readable.
+ * WM_NAME is set as STRING exactly as XStoreName() did (dwm reads this); _NET_WM_NAME as UTF8_STRING.
+ */
+static int xorgError(Display *d, XErrorEvent *ee) {
+   char text[128];
+
+   XGetErrorText(d, ee->error_code, text, sizeof(text));
+   fprintf(stderr, "statusInfo: X error: request %d: %s\n", ee->request_code, text);
+   return 0;
+}
+
+static int xorgIOError(Display *d) {
+   fprintf(stderr, "statusInfo: connection to X server lost: exiting\n");
+   exit(1);    /* Xlib exits anyway if this returns */
+}
+
+static void xorgInit(void) {
+   XSetErrorHandler(xorgError);
+   XSetIOErrorHandler(xorgIOError);
+   utf8String=XInternAtom(dpy, "UTF8_STRING", False);
+   netWmName=XInternAtom(dpy, "_NET_WM_NAME", False);
+}
+
+/* Read pending X events: this is where asynchronous errors and server death are detected */
+static int xorgEvent(si_state *st, si_source *src, uint32_t events) {
+   XEvent ev;
+
+   while (XPending(dpy))
+      XNextEvent(dpy, &ev);
+   return 0;
+}
+
+static void setXorgBarText(char *str) {
+   int len=strlen(str);
+
+   XChangeProperty(dpy, DefaultRootWindow(dpy), XA_WM_NAME, XA_STRING, 8, PropModeReplace, (unsigned char *)str, len);
+   XChangeProperty(dpy, DefaultRootWindow(dpy), netWmName, utf8String, 8, PropModeReplace, (unsigned char *)str, len);
+   statSyscall(statSink+xorg);
+   XFlush(dpy);
+}
+
+/* dwlb output. The message format is taken from dwlb, as used when the -status command is given in dwlb.
+ * dwlb reads a single message from each connection and then closes it, so a connection can not be kept
+ * open between updates. Instead each connect / send is non-blocking (MSG_NOSIGNAL: no SIGPIPE if dwlb
+ * has gone away), the connection is monitored (evAdd()) until dwlb closes it, and if dwlb is not
+ * there (e.g. not started yet, or restarting) the latest message is kept and resent from a retry timer
+ * with exponential backoff between DWLB_RETRY_MIN and DWLB_RETRY_MAX. Nothing ever waits for dwlb.
+ */
+static void dwlbClose(void) {
+   if (dwlbConn.fd<0)
+      return;
+   evDel(dwlbConn.src);
+   close(dwlbConn.fd);
+   dwlbConn.fd=-1;
+   dwlbConn.src=NULL;
+}
+
+/* dwlb closed the connection after reading the message, or went away */
+static int dwlbEvent(si_state *st, si_source *src, uint32_t events) {
+   dwlbClose();
+   return 0;
+}
+
+static int dwlbFlush(void) {
+   int fd=-1;
+   ssize_t r;
+
+   if (dwlbConn.pending[0]=='\0')
+      return 0;
+   dwlbClose();   /* Previous message: dwlb has read it or will still read it from its queue */
+
+   statSyscall(statSink+dwlb);
+   fd=socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+   if (fd==-1) {
+      perror("dwlbFlush: Opening socket");
+      goto retry;
+   }
+   statSyscall(statSink+dwlb);
+   if (connect(fd, (struct sockaddr *)&dwlbConn.addr, sizeof(dwlbConn.addr))==-1)
+      goto retry;
+   statSyscall(statSink+dwlb);
+   r=send(fd, dwlbConn.pending, strlen(dwlbConn.pending), MSG_NOSIGNAL);
+   if (r==-1)
+      goto retry;
+
+   if (dwlbConn.backoff>0)
+      fprintf(stderr, "dwlbFlush: connected to dwlb on %s\n", dwlbConn.addr.sun_path);
+   dwlbConn.fd=fd;
+   dwlbConn.src=evAdd(fd, EPOLLIN, dwlbEvent, NULL);
+   dwlbConn.backoff=0;
+   dwlbConn.pending[0]='\0';
+   return r;
+
+retry:
+   if (dwlbConn.backoff==0)
+      fprintf(stderr, "dwlbFlush: dwlb not available on %s (%s): retrying\n", dwlbConn.addr.sun_path, strerror(errno));
+   if (fd>=0)
+      close(fd);
+   dwlbConn.backoff=(dwlbConn.backoff==0) ? DWLB_RETRY_MIN : dwlbConn.backoff*2;
+   if (dwlbConn.backoff>DWLB_RETRY_MAX)
+      dwlbConn.backoff=DWLB_RETRY_MAX;
+   schedArm(&timers[timerDwlb], dwlbConn.backoff);
+   return 0;
+}
+
+/* Returns -1 on error or number of bytes sent; 0 if the message is queued for retry */
+static int dwlbSend(const char *output, const char *cmd, const char *data) {
+   if (data!=NULL)
+      snprintf(dwlbConn.pending, sizeof(dwlbConn.pending), "%s %s %s", output, cmd, data);
+   else
+      snprintf(dwlbConn.pending, sizeof(dwlbConn.pending), "%s %s", output, cmd);
+
+   if (dwlbConn.backoff>0)
+      return 0;   /* Retry timer pending: the latest message is sent then */
+   return dwlbFlush();
+}
+
+/* Retry timer */
+static int dwlbRetry(si_state *st) {
+   dwlbFlush();
+   return 0;
+}
+
+/* localtime_r() does not re-check the timezone on every call (unlike localtime()): tzset() is called
+ * by clockInit() and again when the clock is set.
+ */
+static void getTime(si_str *buf, const char *fmt, time_t ctime) {
+   struct tm tmBuf;
+   struct tm *ltime;
+   size_t n, r;
+
+   ltime=localtime_r(&ctime, &tmBuf);
+   if (ltime==NULL) {
+      strCat(buf, "[clock error]");
+      return;
+   }
+   for (n=64; n<=4096; n*=2) {   /* strftime() returns 0 if the result does not fit: retry with more room */
+      if (strReserve(buf, n)==-1)
+         break;
+      r=strftime(buf->s+buf->len, n, fmt, ltime);
+      if (r>0) {
+         buf->len+=r;
+         return;
+      }
+   }
+   strCat(buf, "[clock format error]");
+}
+
+/* Sysfs attribute handles: each attribute is opened once and re-read with pread() at offset 0,
+ * which makes sysfs regenerate the value. If the device goes away (battery or hwmon hot-replug)
+ * the read fails with ENODEV / ESTALE and the path is reopened on the next read.
+ */
+static void sysAttrClose(si_sysAttr *attr) {
+   if (attr->fd>=0)
+      close(attr->fd);
+   attr->fd=-1;
+}
+
+static int sysAttrOpen(si_sysAttr *attr, const char *sysPath) {
+   attr->fd=-1;
+   if (snprintf(attr->path, MX_PATH_LEN, "%s", sysPath) >= MX_PATH_LEN) {
+      fprintf(stderr, "ERROR: sysAttrOpen: MX_PATH_LEN exceeded.\n");
+      attr->path[0]='\0';
+      return -1;
+   }
+   attr->fd=open(attr->path, O_RDONLY|O_CLOEXEC);
+   return attr->fd;
+}
+
+/* Parse a decimal integer as written by sysfs (optional sign, digits, trailing newline) */
+static int parseLong(const char *buf, ssize_t len, long *value) {
+   ssize_t i=0;
+   long v=0;
+   int neg=0;
+
+   while (i<len && (buf[i]==' ' || buf[i]=='\t'))
+      i++;
+   if (i<len && (buf[i]=='-' || buf[i]=='+'))
+      neg=(buf[i++]=='-');
+   if (i>=len || buf[i]<'0' || buf[i]>'9')
+      return -1;
+   for (; i<len && buf[i]>='0' && buf[i]<='9'; i++)
+      v=v*10+(buf[i]-'0');
+   *value=neg ? -v : v;
+   return 0;
+}
+
+/* Read up to size bytes of the attribute from offset 0. Returns the number of bytes read, or -1 */
+static ssize_t sysAttrRead(si_sysAttr *attr, char *buf, size_t size) {
+   struct timespec t;
+   ssize_t n=-1;
+   int retry, err;
+
+   if (attr->path[0]=='\0')
+      return -1;
+
+   statStart(&t);
+   for (retry=0; retry<2; retry++) {
+      if (attr->fd<0) {
+         statSyscall(statSysfs);
+         if ((attr->fd=open(attr->path, O_RDONLY|O_CLOEXEC))<0)
+            break;
+      }
+      statSyscall(statSysfs);
+      n=pread(attr->fd, buf, size, 0);
+      if (n>=0)
+         break;
+      err=errno;   /* Before close() */
+      sysAttrClose(attr);
+      if (err!=ENODEV && err!=ESTALE)
+         break;
+      /* Device was removed and maybe replugged: reopen path and try again */
+   }
+   statEnd(statSysfs, &t);
+   return n;
+}
+
+/* Returns -1 on error (same convention as the original fscanf() based reader) */
+long getSysInfo(si_sysAttr *attr) {
+   char buf[32];
+   ssize_t n;
+   long sysInfo=-1;
+
+   n=sysAttrRead(attr, buf, sizeof(buf));
+   if (n>0 && parseLong(buf, n, &sysInfo)<0)
+      sysInfo=-1;
+
+   return sysInfo;
+}
+
+/* Collector thread (COLLECTOR_THREAD): probes that can block for tens of milliseconds (ethtool ioctls on
+ * USB NICs, hwmon reads of ACPI EC sensors) run on a thread of their own, so they never delay the
+ * main loop and its notifications. Requests and results are passed in two single producer / single
+ * consumer rings without locks, each with an eventfd to wake the other side. The ethtool cache
+ * (ethCache) belongs to the thread while it runs: the main thread only queues resets (ethInvalidate()).
+ * nl80211 station dumps are already asynchronous in the main loop (wifiQueryRecv()).
+ */
+static int ringPut(si_ring *r, const si_probe *p) {
+   unsigned int head=r->head;
+
+   if (head-__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)>=MX_PROBES)
+      return -1;   /* Full */
+   r->slot[head&(MX_PROBES-1)]=*p;
+   __atomic_store_n(&r->head, head+1, __ATOMIC_RELEASE);
+   return 0;
+}
+
+static int ringGet(si_ring *r, si_probe *p) {
+   unsigned int tail=r->tail;
+
+   if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE)==tail)
+      return -1;   /* Empty */
+   *p=r->slot[tail&(MX_PROBES-1)];
+   __atomic_store_n(&r->tail, tail+1, __ATOMIC_RELEASE);
+   return 0;
+}
+
+static void eventfdSignal(int fd) {
+   uint64_t one=1;
+
+   if (write(fd, &one, sizeof(one))==-1 && errno!=EAGAIN)
+      perror("eventfdSignal");
+}
+
+/* Queue a probe for the thread. Returns -1 if the thread is not running or the ring is full: the
+ * caller probes inline
+ */
+static int collectorRequest(const si_probe *p) {
+   if (!collector.running || ringPut(&collector.req, p)==-1)
+      return -1;
+   eventfdSignal(collector.reqFd);
+   return 0;
+}
+
+static int collectorProbeEth(si_netIf *netIf) {
+   si_probe p;
+
+   memset(&p, 0, sizeof(p));
+   p.type=probeEth;
+   p.ifindex=netIf->ifindex;
+   memcpy(p.name, netIf->name, IFNAMSIZ);
+   return collectorRequest(&p);
+}
+
+static int collectorProbeTmp(const char *path) {
+   si_probe p;
+
+   memset(&p, 0, sizeof(p));
+   p.type=probeTmp;
+   snprintf(p.path, MX_PATH_LEN, "%s", path);
+   return collectorRequest(&p);
+}
+
+static void ethInvalidate(unsigned int ifindex) {
+   si_probe p;
+
+   if (!collector.running) {
+      ethCacheInvalidate(ifindex);
+      return;
+   }
+   memset(&p, 0, sizeof(p));
+   p.type=probeEthReset;
+   p.ifindex=ifindex;
+   if (collectorRequest(&p)==-1) {   /* Ring full: reset all before the next probe */
+      __atomic_store_n(&collector.resetAll, 1, __ATOMIC_RELEASE);
+      eventfdSignal(collector.reqFd);
+   }
+}
+
+static void *collectorThread(void *arg) {
+   si_sysAttr tmp={ .fd=-1 };   /* Sensor read by the thread */
+   struct timespec t;
+   si_probe p;
+   uint64_t n;
+
+   while (!__atomic_load_n(&collector.quit, __ATOMIC_ACQUIRE)) {
+      if (read(collector.reqFd, &n, sizeof(n))==-1 && errno!=EINTR)
+         break;
+      if (__atomic_exchange_n(&collector.resetAll, 0, __ATOMIC_ACQ_REL))
+         ethCacheInvalidate(0);
+      while (ringGet(&collector.req, &p)==0) {
+         switch (p.type) {
+            case probeEth:
+               statStart(&t);
+               p.speed=getEthernetStatus(p.name, p.displayStatus);
+               statEnd(statEth, &t);
+               break;
+            case probeEthReset:
+               ethCacheInvalidate(p.ifindex);
+               continue;   /* No result */
+            case probeTmp:
+               if (strcmp(tmp.path, p.path)!=0) {   /* Sensor changed */
+                  sysAttrClose(&tmp);
+                  snprintf(tmp.path, MX_PATH_LEN, "%s", p.path);
+               }
+               p.value=getSysInfo(&tmp);
+               break;
+         }
+         if (ringPut(&collector.res, &p)==-1) {
+            fprintf(stderr, "collectorThread: result ring full: result dropped\n");
+            if (p.type==probeEth)   /* The interface is no longer stale on the main thread */
+               __atomic_store_n(&collector.ethLost, 1, __ATOMIC_RELEASE);
+         }
+         eventfdSignal(collector.resFd);
+      }
+   }
+   sysAttrClose(&tmp);
+   return NULL;
+}
+
+/* Start the collector thread: on failure the probes run inline */
+static int collectorInit(void) {
+   int ret;
+
+   collector.reqFd=eventfd(0, EFD_CLOEXEC);   /* Blocking: the thread sleeps in read() */
+   collector.resFd=eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+   if (collector.reqFd==-1 || collector.resFd==-1) {
+      perror("collectorInit: eventfd");
+      return -1;
+   }
+   ret=pthread_create(&collector.thread, NULL, collectorThread, NULL);
+   if (ret!=0) {
+      fprintf(stderr, "collectorInit: pthread_create: %s\n", strerror(ret));
+      return -1;
+   }
+   collector.running=1;
+   return 0;
+}
+
+static void collectorClose(void) {
+   if (collector.running) {
+      __atomic_store_n(&collector.quit, 1, __ATOMIC_RELEASE);
+      eventfdSignal(collector.reqFd);
+      pthread_join(collector.thread, NULL);
+      collector.running=0;
+   }
+   if (collector.reqFd>=0)
+      close(collector.reqFd);
+   if (collector.resFd>=0)
+      close(collector.resFd);
+}
+
+/* Power supplies and hwmon temperature sensors are found with one udev enumeration at startup and then
+ * kept current from the add / remove events of the udev monitor, so sysfs is never rescanned.
+ */
+/* Open an optional attribute: the path is cleared if it does not exist so it is not retried on each read */
+static void sysDevAttr(si_sysAttr *attr, const char *syspath, const char *name) {
+   char path[MX_PATH_LEN];
+
+   snprintf(path, MX_PATH_LEN, "%s/%s", syspath, name);
+   if (sysAttrOpen(attr, path)<0 && errno==ENOENT)
+      attr->path[0]='\0';
+}
+
+static void supplyClose(si_supply *sup) {
+   sysAttrClose(&sup->capacity);
+   sysAttrClose(&sup->status);
+   sysAttrClose(&sup->powerNow);
+   sysAttrClose(&sup->currentNow);
+   sysAttrClose(&sup->voltageNow);
+   sysAttrClose(&sup->energyNow);
+   sysAttrClose(&sup->energyFull);
+   sysAttrClose(&sup->online);
+}
+
+static void backlightClose(si_backlight *bl) {
+   sysAttrClose(&bl->brightness);
+   sysAttrClose(&bl->power);
+   bl->syspath[0]='\0';
+}
+
+/* Rank of hwmon name in cfg.thermalName (terms terminated by '\n'), or -1 if not listed */
+static int thermalRank(const char *name) {
+   const char *t, *e;
+   int rank;
+
+   if (name==NULL)
+      return -1;
+   for (t=cfg.thermalName, rank=0; (e=strchr(t, '\n'))!=NULL; t=e+1, rank++) {
+      if (strlen(name)==(size_t)(e-t) && strncmp(t, name, e-t)==0)
+         return rank;
+   }
+   return -1;
+}
+
+/* Display the best ranked sensor. Returns 1 if the displayed sensor changed */
+static int thermalSelect(si_sysDevs *d) {
+   char path[MX_PATH_LEN];
+   int i, best=-1;
+
+   for (i=0; i<d->nSensors; i++) {
+      if (d->sensors[i].rank>=0 && (best==-1 || d->sensors[i].rank<d->sensors[best].rank))
+         best=i;
+   }
+   path[0]='\0';   /* Also if MX_PATH_LEN is exceeded */
+   if (best>=0 && snprintf(path, MX_PATH_LEN, "%s/%s", d->sensors[best].syspath, cfg.tempInput)>=MX_PATH_LEN)
+      best=-1;
+   if (strcmp(path, d->thermal.path)==0)
+      return 0;
+
+   sysAttrClose(&d->thermal);
+   d->thermal.path[0]='\0';
+   d->thermalChanged=1;
+   if (best>=0) {
+      fprintf(stderr, "thermalSelect: using %s\n", path);
+      sysAttrOpen(&d->thermal, path);
+   }
+   else
+      fprintf(stderr, "thermalSelect: no sensor matching thermal_name: temperature readout not available\n");
+   return 1;
+}
+
+static void sysDevRemove(si_sysDevs *d, const char *syspath) {
+   int i;
+
+   for (i=0; i<d->nSupplies; i++) {
+      if (strcmp(d->supplies[i].syspath, syspath)==0) {
+         supplyClose(&d->supplies[i]);
+         d->supplies[i]=d->supplies[--d->nSupplies];
+         return;
+      }
+   }
+   for (i=0; i<d->nSensors; i++) {
+      if (strcmp(d->sensors[i].syspath, syspath)==0) {
+         d->sensors[i]=d->sensors[--d->nSensors];
+         return;
+      }
+   }
+   if (strcmp(d->backlight.syspath, syspath)==0)
+      backlightClose(&d->backlight);
+}
+
+/* Add a power_supply, hwmon or backlight device to the table. Peripheral batteries (scope Device: mice,
+ * headsets) are not system batteries and are ignored. Only the first backlight is kept.
+ */
+static void sysDevAdd(si_sysDevs *d, struct udev_device *dev) {
+   const char *subsystem=udev_device_get_subsystem(dev);
+   const char *syspath=udev_device_get_syspath(dev);
+   const char *type, *scope, *name, *max, *value;
+   si_supply *sup;
+   si_sensor *sen;
+   si_backlight *bl=&d->backlight;
+
+   if (subsystem==NULL || syspath==NULL)
+      return;
+   sysDevRemove(d, syspath);   /* Re-added: e.g. driver rebound */
+
+   if (strcmp(subsystem, "power_supply")==0) {
+      type=udev_device_get_sysattr_value(dev, "type");
+      scope=udev_device_get_sysattr_value(dev, "scope");
+      if (type==NULL || (scope!=NULL && strcmp(scope, "Device")==0))
+         return;
+      if (d->nSupplies>=MX_SUPPLIES) {
+         fprintf(stderr, "sysDevAdd: too many power supplies: %s ignored\n", syspath);
+         return;
+      }
+      sup=&d->supplies[d->nSupplies++];
+      memset(sup, 0, sizeof(*sup));
+      sup->capacity.fd=sup->status.fd=sup->powerNow.fd=sup->currentNow.fd=sup->voltageNow.fd=sup->energyNow.fd=sup->energyFull.fd=sup->online.fd=-1;
+      snprintf(sup->syspath, MX_PATH_LEN, "%s", syspath);
+      snprintf(sup->name, sizeof(sup->name), "%s", udev_device_get_sysname(dev));
+      sup->battery=(strcmp(type, "Battery")==0);
+      if (sup->battery) {
+         sysDevAttr(&sup->capacity, syspath, "capacity");
+         sysDevAttr(&sup->status, syspath, "status");
+         sysDevAttr(&sup->powerNow, syspath, "power_now");
+         sysDevAttr(&sup->currentNow, syspath, "current_now");
+         sysDevAttr(&sup->voltageNow, syspath, "voltage_now");
+         sysDevAttr(&sup->energyNow, syspath, "energy_now");
+         sysDevAttr(&sup->energyFull, syspath, "energy_full");
+         if (sup->energyFull.path[0]=='\0') {
+            sup->charge=1;
+            sysAttrClose(&sup->energyNow);   /* energy_now without energy_full */
+            sysDevAttr(&sup->energyNow, syspath, "charge_now");
+            sysDevAttr(&sup->energyFull, syspath, "charge_full");
+            if ((value=udev_device_get_sysattr_value(dev, "voltage_min_design"))!=NULL)
+               sup->voltageMin=atol(value);
+         }
+      }
+      else
+         sysDevAttr(&sup->online, syspath, "online");
+      fprintf(stderr, "sysDevAdd: %s %s\n", sup->battery ? "battery" : "adapter", sup->name);
+   }
+   else if (strcmp(subsystem, "hwmon")==0) {
+      if ((name=udev_device_get_sysattr_value(dev, "name"))==NULL)
+         return;
+      if (d->nSensors>=MX_SENSORS) {
+         fprintf(stderr, "sysDevAdd: too many sensors: %s ignored\n", syspath);
+         return;
+      }
+      sen=&d->sensors[d->nSensors++];
+      snprintf(sen->syspath, MX_PATH_LEN, "%s", syspath);
+      snprintf(sen->name, sizeof(sen->name), "%s", name);
+      sen->rank=thermalRank(sen->name);
+   }
+   else if (strcmp(subsystem, "backlight")==0 && bl->syspath[0]=='\0') {
+      if ((max=udev_device_get_sysattr_value(dev, "max_brightness"))==NULL || atol(max)<=0)
+         return;
+      snprintf(bl->syspath, MX_PATH_LEN, "%s", syspath);
+      bl->max=atol(max);
+      sysDevAttr(&bl->brightness, syspath, "actual_brightness");
+      sysDevAttr(&bl->power, syspath, "bl_power");
+      fprintf(stderr, "sysDevAdd: backlight %s\n", udev_device_get_sysname(dev));
+   }
+}
+
+/* After resume: drop the devices whose sysfs directory is gone. Returns 1 if any was */
+static int sysDevRevalidate(si_sysDevs *d) {
+   int i, removed=0;
+
+   for (i=0; i<d->nSupplies; i++) {
+      if (access(d->supplies[i].syspath, F_OK)==0)
+         continue;
+      fprintf(stderr, "sysDevRevalidate: %s removed\n", d->supplies[i].name);
+      sysDevRemove(d, d->supplies[i].syspath);
+      i--;
+      removed=1;
+   }
+   for (i=0; i<d->nSensors; i++) {
+      if (access(d->sensors[i].syspath, F_OK)==0)
+         continue;
+      fprintf(stderr, "sysDevRevalidate: %s removed\n", d->sensors[i].name);
+      sysDevRemove(d, d->sensors[i].syspath);
+      i--;
+      removed=1;
+   }
+   if (d->backlight.syspath[0]!='\0' && access(d->backlight.syspath, F_OK)==-1) {
+      sysDevRemove(d, d->backlight.syspath);
+      removed=1;
+   }
+   if (removed) {
+      thermalSelect(d);
+      d->powerState=1;
+   }
+   return removed;
+}
+
+/* thermal_name was reloaded: rank the sensors again. Returns 1 if the displayed sensor changed */
+static int sysDevRank(si_sysDevs *d) {
+   int i;
+
+   for (i=0; i<d->nSensors; i++)
+      d->sensors[i].rank=thermalRank(d->sensors[i].name);
+   return thermalSelect(d);
+}
+
+static void sysDevScan(si_sysDevs *d, struct udev *udevCtx) {
+   struct udev_enumerate *e;
+   struct udev_list_entry *entry;
+   struct udev_device *dev;
+
+   memset(d, 0, sizeof(*d));
+   d->thermal.fd=d->backlight.brightness.fd=d->backlight.power.fd=-1;
+   d->capacity=-1;
+   if (udevCtx==NULL || (e=udev_enumerate_new(udevCtx))==NULL) {
+      fprintf(stderr, "sysDevScan: udev not available: battery and temperature not reported\n");
+      return;
+   }
+
+   /* Monitor started before the scan so no device is missed */
+   d->mon=udev_monitor_new_from_netlink(udevCtx, "udev");
+   if (d->mon!=NULL && (udev_monitor_filter_add_match_subsystem_devtype(d->mon, "power_supply", NULL)<0
+         || udev_monitor_filter_add_match_subsystem_devtype(d->mon, "hwmon", NULL)<0
+         || udev_monitor_filter_add_match_subsystem_devtype(d->mon, "backlight", NULL)<0 || udev_monitor_enable_receiving(d->mon)<0))
+      d->mon=udev_monitor_unref(d->mon);
+   if (d->mon==NULL)
+      fprintf(stderr, "sysDevScan: udev monitor failed: supplies and sensors added later are not reported\n");
+   udev_enumerate_add_match_subsystem(e, "power_supply");
+   udev_enumerate_add_match_subsystem(e, "hwmon");
+   udev_enumerate_add_match_subsystem(e, "backlight");
+   if (udev_enumerate_scan_devices(e)<0)
+      fprintf(stderr, "sysDevScan: udev_enumerate_scan_devices failed\n");
+   udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(e)) {
+      dev=udev_device_new_from_syspath(udevCtx, udev_list_entry_get_name(entry));
+      if (dev!=NULL) {
+         sysDevAdd(d, dev);
+         udev_device_unref(dev);
+      }
+   }
+   udev_enumerate_unref(e);
+   thermalSelect(d);
+}
+
+/* udev event for a power_supply, hwmon or backlight device. Returns 1 if a device was added or removed,
+ * or a battery reported a change (the driver's own update cadence: this is a new power model sample).
+ * Adapter and backlight changes are left to the refresh policy (powerState).
+ */
+static int sysDevEvent(si_sysDevs *d, struct udev_device *dev) {
+   const char *action=udev_device_get_action(dev);
+   const char *syspath=udev_device_get_syspath(dev);
+   int i;
+
+   if (action==NULL || syspath==NULL)
+      return 0;
+   if (strcmp(action, "change")==0) {
+      for (i=0; i<d->nSupplies; i++) {
+         if (d->supplies[i].battery && strcmp(d->supplies[i].syspath, syspath)==0) {
+            d->power.event=1;
+            return 1;
+         }
+         if (strcmp(d->supplies[i].syspath, syspath)==0)
+            d->powerState=1;
+      }
+      if (strcmp(d->backlight.syspath, syspath)==0)
+         d->powerState=1;
+      return 0;
+   }
+   if (strcmp(action, "add")==0)
+      sysDevAdd(d, dev);
+   else if (strcmp(action, "remove")==0)
+      sysDevRemove(d, syspath);
+   else
+      return 0;
+   thermalSelect(d);
+   d->powerState=1;
+   return 1;
+}
+
+/* Batteries report a change every few seconds to minutes. These events are only samples for the power
+ * model, so their monitor is not in the event loop: it is read on the next wakeup for anything else (a
+ * scaled timer or the clock, POLICY_INTERVAL at most). While blanked the only wakeup would be
+ * POLICY_INTERVAL, so the monitor is in the event loop (sysDevWake()) and the backlight coming back on
+ * is seen at once. Returns 1 if sysDevEvent() did.
+ */
+static int sysDevDrain(si_sysDevs *d) {
+   struct udev_device *dev;
+   int changed=0;
+
+   if (d->mon==NULL)
+      return 0;
+   while ((dev=udev_monitor_receive_device(d->mon))!=NULL) {   /* Non blocking */
+      changed|=sysDevEvent(d, dev);
+      udev_device_unref(dev);
+   }
+   return changed;
+}
+
+/* Monitor readable while blanked: it is read by sysDevDrain() after the dispatch */
+static int sysDevWake(si_state *st, si_source *src, uint32_t events) {
+   return 0;
+}
+
+static void sysDevClose(si_sysDevs *d) {
+   int i;
+
+   if (d->mon!=NULL)
+      udev_monitor_unref(d->mon);
+   for (i=0; i<d->nSupplies; i++)
+      supplyClose(&d->supplies[i]);
+   sysAttrClose(&d->thermal);
+   backlightClose(&d->backlight);
+}
+
+/* Store newly rendered text for an element. Returns 1 if it differs from the cached text, otherwise 0 */
+static int elementSet(si_element *el, const si_str *text) {
+   if (textSet(&el->text, text->s, text->len)<=0)
+      return 0;
+   el->version++;
+   return 1;
+}
+
+/* Status element updates: each module renders its own element(s) into st->element[] on its own
+ * timer (see timers[] below) or when an event for it arrives; getStatusInfo() only concatenates.
+ */
+/* Clock: an absolute CLOCK_REALTIME timerfd expires when the displayed time changes (on the second or
+ * the minute, depending on CLOCK_FORMAT). TFD_TIMER_CANCEL_ON_SET makes the timer fire with ECANCELED
+ * when the clock is set (NTP step, manual change), and a realtime timer also expires on resume if its
+ * deadline passed during suspend, so the clock is never shown stale.
+ */
+static int clockArm(si_clock *clk) {
+   struct itimerspec its;
+
+   memset(&its, 0, sizeof(its));
+   its.it_value.tv_sec=(time(NULL)/clk->period+1)*clk->period;
+   if (timerfd_settime(clk->fd, TFD_TIMER_ABSTIME|TFD_TIMER_CANCEL_ON_SET, &its, NULL)==-1) {
+      perror("clockArm(): timerfd_settime");
+      return -1;
+   }
+   return 0;
+}
+
+/* Period of the displayed time from clock_format. The flags (-_0^#), field width and E/O modifiers
+ * of a conversion are skipped: %-S, %OS and %Ec show seconds too.
+ */
+static void clockPeriod(si_clock *clk) {
+   const char *c=cfg.clockFormat;
+
+   clk->shown=-1;
+   clk->period=60;
+   while ((c=strchr(c, '%'))!=NULL) {
+      c++;
+      c+=strspn(c, "-_0^#");
+      c+=strspn(c, "0123456789");
+      if (*c=='E' || *c=='O')
+         c++;
+      if (*c=='\0')
+         break;
+      if (strchr("STsrcX", *c)!=NULL)   /* Conversions that include seconds (%c always does) */
+         clk->period=1;
+      c++;   /* Past the conversion: %% is not the start of another one */
+   }
+}
+
+static int clockInit(si_clock *clk) {
+   tzset();
+   clockPeriod(clk);
+   clk->fd=timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK|TFD_CLOEXEC);
+   if (clk->fd<0) {
+      perror("clockInit(): timerfd_create");
+      return -1;
+   }
+   return clockArm(clk);
+}
+
+static int updateClock(si_state *st) {
+   si_clock *clk=&st->clock;
+   time_t now=time(NULL);
+   si_str buf;
+
+   if (clk->shown!=-1 && now/clk->period==clk->shown/clk->period)
+      return 0;   /* Displayed time has not changed */
+   strInit(&buf);
+   getTime(&buf, cfg.clockFormat, now);
+   clk->shown=now;
+   return elementSet(&st->element[elClock], &buf);
+}
+
+/* Called when the clock timerfd is readable */
+static int clockEvent(si_state *st, si_source *src, uint32_t events) {
+   si_clock *clk=&st->clock;
+   uint64_t expirations;
+
+   if (read(clk->fd, &expirations, sizeof(expirations))==-1) {
+      if (errno==ECANCELED) {   /* Clock was set: timezone may have changed too */
+         tzset();
+         clk->shown=-1;
+      }
+      else if (errno!=EAGAIN)
+         perror("clockEvent(): read");
+   }
+   if (policy.blanked)   /* Left disarmed: policyResume() re-arms and redraws the clock */
+      return 0;
+   clockArm(clk);
+   return updateClock(st);
+}
+
+static int showTmp(si_state *st, long milliDegrees) {
+   si_str tmp;
+   si_shm *s;
+
+   strInit(&tmp);
+   if (st->devs.thermalChanged) {   /* Readings of the previous sensor are not comparable */
+      memset(&st->tmpHistory, 0, sizeof(st->tmpHistory));
+      st->devs.thermalChanged=0;
+   }
+   if (milliDegrees!=-1)
+      historyAdd(&st->tmpHistory, milliDegrees);
+   if (st->devs.thermal.path[0] != '\0') {
+      strPrintf(&tmp, "tmp:%liC", (milliDegrees!=-1) ? milliDegrees/1000 : -1);
+      historyRender(&tmp, &st->tmpHistory, cfg.history, 1000, 0);
+   }
+   if ((s=shmBegin())!=NULL) {
+      s->temperature=milliDegrees;
+      shmEnd(s);
+   }
+   return elementSet(&st->element[elTmp], &tmp);
+}
+
+static int updateTmp(si_state *st) {
+   if (st->devs.thermal.path[0]!='\0' && collectorProbeTmp(st->devs.thermal.path)==0)
+      return 0;   /* Shown when the collector thread replies */
+   return showTmp(st, getSysInfo(&st->devs.thermal));
+}
+
+/* Battery power (uW) from power_now, or current_now x voltage_now; -1 if unknown */
+static long supplyPower(si_supply *sup) {
+   long p, i, v;
+
+   if ((p=getSysInfo(&sup->powerNow))>=0)
+      return p;
+   i=getSysInfo(&sup->currentNow);
+   v=getSysInfo(&sup->voltageNow);
+   if (i==-1 || v<=0)
+      return -1;
+   return (long long)labs(i)*v/1000000;   /* Some drivers report charging current as negative */
+}
+
+/* Energy (uWh) of attr (energy_now or energy_full), converted from charge (uAh) at voltage_now if needed */
+static long supplyEnergy(si_supply *sup, si_sysAttr *attr) {
+   long e, v;
+
+   e=getSysInfo(attr);
+   if (e<0 || !sup->charge)
+      return e;
+   v=getSysInfo(&sup->voltageNow);
+   return (v>0) ? (long long)e*v/1000000 : -1;
+}
+
+/* -1 if any battery is discharging, 1 if one is charging, 0 otherwise (full, not charging) */
+static int batteryDirection(si_sysDevs *d) {
+   char buf[16];
+   ssize_t n;
+   int i, dir=0;
+
+   for (i=0; i<d->nSupplies; i++) {
+      if (!d->supplies[i].battery || (n=sysAttrRead(&d->supplies[i].status, buf, sizeof(buf)))<=0)
+         continue;
+      if (n>=11 && memcmp(buf, "Discharging", 11)==0)
+         return -1;
+      if (n>=8 && memcmp(buf, "Charging", 8)==0)
+         dir=1;
+   }
+   return dir;
+}
+
+/* Add the reading to the power model if it is a new sample. Returns 1 if it was added */
+static int powerSample(si_power *pw, long raw, int direction) {
+   if (direction!=pw->direction) {
+      pw->direction=direction;
+      pw->n=0;
+   }
+   if (!pw->event && pw->n>0 && raw==pw->lastRaw)
+      return 0;
+   pw->event=0;
+   pw->lastRaw=raw;
+   if (raw<0)
+      return 0;
+   pw->head=(pw->head+1)%POWER_SAMPLES;
+   pw->samples[pw->head]=raw;
+   if (pw->n<POWER_SAMPLES)
+      pw->n++;
+   return 1;
+}
+
+/* Smoothed power (uW), or -1 if there is no sample */
+static long powerSmoothed(si_power *pw) {
+   double w=1, sum=0, wSum=0;
+   int k;
+
+   for (k=0; k<pw->n; k++) {
+      sum+=w*pw->samples[(pw->head-k+POWER_SAMPLES)%POWER_SAMPLES];
+      wSum+=w;
+      w*=POWER_SMOOTHING;
+   }
+   return (pw->n>0) ? (long)(sum/wSum) : -1;
+}
+
+/* Combined charge (%) of all system batteries, weighted by their full capacity if every battery reports
+ * it (otherwise the mean), their total power, energy and full energy (uWh; -1 if unknown).
+ * Returns -1 if there is no battery.
+ */
+static long batteryCapacity(si_sysDevs *d, long *microWatts, long *energyNow, long *energyFull) {
+   long cap, full, wh, p, e, ef, capSum=0;
+   long weighted[2]={ 0, 0 }, fullSum[2]={ 0, 0 };   /* Weights in the supply's own unit (uWh or uAh), in uWh */
+   int i, n=0, u, useFull[2]={ 1, 1 }, families=0;
+   si_supply *sup;
+
+   *microWatts=-1;
+   *energyNow=*energyFull=0;
+   for (i=0; i<d->nSupplies; i++) {
+      sup=&d->supplies[i];
+      if (!sup->battery || (cap=getSysInfo(&sup->capacity))==-1)
+         continue;
+      n++;
+      capSum+=cap;
+      families|=sup->charge ? 2 : 1;
+      full=getSysInfo(&sup->energyFull);
+      wh=(full>0 && sup->charge) ? ((sup->voltageMin>0) ? (long long)full*sup->voltageMin/1000000 : -1) : full;
+      if (full>0) {
+         weighted[0]+=cap*(full/1000);   /* mWh or mAh: keeps the products within a long */
+         fullSum[0]+=full/1000;
+      }
+      else
+         useFull[0]=0;
+      if (wh>0) {
+         weighted[1]+=cap*(wh/1000);
+         fullSum[1]+=wh/1000;
+      }
+      else
+         useFull[1]=0;
+      if ((p=supplyPower(sup))>=0)
+         *microWatts=((*microWatts>0) ? *microWatts : 0)+p;
+      e=supplyEnergy(sup, &sup->energyNow);
+      ef=supplyEnergy(sup, &sup->energyFull);
+      if (e<0 || ef<0 || *energyNow<0)
+         *energyNow=*energyFull=-1;
+      else {
+         *energyNow+=e;
+         *energyFull+=ef;
+      }
+   }
+   if (n==0)
+      return -1;
+   u=(families==3);   /* Both energy_* and charge_* batteries: weighted in uWh, at voltage_min_design */
+   if (useFull[u] && fullSum[u]>0)
+      return (weighted[u]+fullSum[u]/2)/fullSum[u];
+   return capSum/n;
+}
+
+/* Battery: on BATTERY_INTERVAL and on battery change events (see sysDevEvent()). Power is shown smoothed
+ * to a tenth of a watt, with the time to empty (discharging) or to full (charging, '+') from it.
+ */
+static int updateBat(si_state *st) {
+   long batCapacityNow;
+   long microWatts, energyNow, energyFull, smoothed, tenths, minutes=-1;
+   si_str pwr, bat;
+   si_shm *s;
+   si_power *pw=&st->devs.power;
+
+   batCapacityNow=batteryCapacity(&st->devs, &microWatts, &energyNow, &energyFull);
+   st->devs.capacity=batCapacityNow;
+   if (powerSample(pw, microWatts, batteryDirection(&st->devs)))
+      historyAdd(&st->pwrHistory, microWatts);
+   smoothed=powerSmoothed(pw);
+   if (smoothed>0 && energyNow>=0) {
+      if (pw->direction<0)
+         minutes=(long long)energyNow*60/smoothed;
+      else if (pw->direction>0 && energyFull>energyNow)
+         minutes=(long long)(energyFull-energyNow)*60/smoothed;
+      if (minutes>=100*60)
+         minutes=-1;   /* Not a meaningful estimate */
+   }
+   if ((s=shmBegin())!=NULL) {
+      s->batCapacity=batCapacityNow;
+      s->batPowerNow=microWatts;
+      shmEnd(s);
+   }
+   strInit(&pwr);
+   strInit(&bat);
+
+   tenths=(smoothed+50000)/100000;
+   if (smoothed>0 && tenths>0) {
+      strPrintf(&pwr, "pwr:%li.%liW", tenths/10, tenths%10);
+      historyRender(&pwr, &st->pwrHistory, cfg.history, 1000000, 1);
+   }
+
+   if (batCapacityNow>cfg.batteryLow)
+      strPrintf(&bat, "bat:%li%%", batCapacityNow);
+   else {
+      if (batCapacityNow!=-1)
+         strPrintf(&bat, "[!]bat:%li%%", batCapacityNow);
+   }
+   if (batCapacityNow!=-1 && minutes>=0)
+      strPrintf(&bat, " %s%li:%02li", (pw->direction>0) ? "+" : "", minutes/60, minutes%60);
+   return elementSet(&st->element[elPwr], &pwr) | elementSet(&st->element[elBat], &bat);
+}
+
+/* CPU, memory and pressure from /proc. Each file is kept open and only its start is re-read into a
+ * preallocated buffer (on a large machine /proc/stat has a line per cpu, but only the aggregate first line
+ * is needed), then scanned by hand.
+ */
+static void procInit(si_proc *proc) {
+   static const char *psiName[psiCount]={ "cpu", "memory", "io" };
+   int i;
+
+   memset(proc, 0, sizeof(*proc));
+   sysDevAttr(&proc->stat, "/proc", "stat");
+   sysDevAttr(&proc->meminfo, "/proc", "meminfo");
+   for (i=0; i<psiCount; i++)   /* Not present without CONFIG_PSI */
+      sysDevAttr(&proc->psi[i], "/proc/pressure", psiName[i]);
+}
+
+static void procClose(si_proc *proc) {
+   int i;
+
+   sysAttrClose(&proc->stat);
+   sysAttrClose(&proc->meminfo);
+   for (i=0; i<psiCount; i++)
+      sysAttrClose(&proc->psi[i]);
+}
+
+/* Parse the next number on the current line of [p, end): returns the position after it, or NULL if the
+ * line has no more numbers
+ */
+static const char *scanNumber(const char *p, const char *end, unsigned long long *v) {
+   for (; p<end && (*p<'0' || *p>'9'); p++) {
+      if (*p=='\n')
+         return NULL;
+   }
+   if (p>=end)
+      return NULL;
+   for (*v=0; p<end && *p>='0' && *p<='9'; p++)
+      *v=*v*10+(*p-'0');
+   return p;
+}
+
+/* Value of the line starting with key (e.g. "MemTotal:"), or -1 */
+static long long scanField(const char *buf, const char *end, const char *key) {
+   size_t len=strlen(key);
+   const char *p;
+   unsigned long long v;
+
+   for (p=buf; p!=NULL && p<end; p=memchr(p, '\n', end-p), p=(p!=NULL) ? p+1 : NULL) {
+      if ((size_t)(end-p)>len && memcmp(p, key, len)==0)
+         return (scanNumber(p+len, end, &v)!=NULL) ? (long long)v : -1;
+   }
+   return -1;
+}
+
+/* CPU busy (%) since the last call, from the aggregate line: cpu user nice system idle iowait irq ...
+ * The counters are not strictly monotonic (iowait can go backwards, the kernel can wrap them): a
+ * sample with a negative total is skipped, the result is clamped to 0..100.
+ */
+static int procCpu(si_proc *proc) {
+   const char *p, *end;
+   unsigned long long v, total=0, idle=0;
+   long long dTotal, dBusy;
+   ssize_t n;
+   int i, busy=-1;
+
+   n=sysAttrRead(&proc->stat, proc->buf, sizeof(proc->buf));
+   if (n<=4 || memcmp(proc->buf, "cpu ", 4)!=0)
+      return -1;
+   end=proc->buf+n;
+   for (i=0, p=proc->buf+4; i<8 && (p=scanNumber(p, end, &v))!=NULL; i++) {   /* guest time is already in user */
+      total+=v;
+      if (i==3 || i==4)   /* idle, iowait */
+         idle+=v;
+   }
+   dTotal=(long long)(total-proc->total);
+   dBusy=dTotal-(long long)(idle-proc->idle);
+   if (proc->total>0 && dTotal>0)
+      busy=(dBusy<0) ? 0 : (dBusy>dTotal) ? 100 : 100*dBusy/dTotal;
+   proc->total=total;
+   proc->idle=idle;
+   return busy;
+}
+
+/* Memory used (%): MemTotal - MemAvailable */
+static int procMem(si_proc *proc) {
+   long long total, avail;
+   ssize_t n;
+
+   n=sysAttrRead(&proc->meminfo, proc->buf, sizeof(proc->buf));
+   if (n<=0)
+      return -1;
+   total=scanField(proc->buf, proc->buf+n, "MemTotal:");
+   avail=scanField(proc->buf, proc->buf+n, "MemAvailable:");
+   if (total<=0 || avail<0)
+      return -1;
+   return 100*(total-avail)/total;
+}
+
+/* Pressure: avg10 of the "some" line (% of time in the last 10 s that a task stalled), or -1 */
+static int procPsi(si_proc *proc, int res) {
+   const char *p, *end;
+   unsigned long long v;
+   ssize_t n;
+
+   n=sysAttrRead(&proc->psi[res], proc->buf, sizeof(proc->buf));
+   if (n<=0)
+      return -1;
+   end=proc->buf+n;
+   p=memchr(proc->buf, '\n', n);
+   if (p==NULL || (p=memmem(proc->buf, p-proc->buf, "avg10=", 6))==NULL || scanNumber(p+6, end, &v)==NULL)
+      return -1;
+   return v;   /* Whole percent: the decimals are not displayed */
+}
+
+static int updateProc(si_state *st) {
+   static const char psiLetter[psiCount]={ 'c', 'm', 'i' };
+   si_str cpu, mem, psi;
+   int busy, used, psiVal[psiCount], i, show=0;
+
+   strInit(&cpu);
+   strInit(&mem);
+   strInit(&psi);
+   if ((busy=procCpu(&st->proc))>=0)
+      strPrintf(&cpu, "cpu:%i%%", busy);
+   if ((used=procMem(&st->proc))>=0)
+      strPrintf(&mem, "mem:%i%%", used);
+   for (i=0; i<psiCount; i++) {
+      psiVal[i]=procPsi(&st->proc, i);
+      if (psiVal[i]>=0 && psiVal[i]>=cfg.psiShow)
+         show=1;
+   }
+   if (show) {   /* Resources whose file is missing or unreadable are left out */
+      strCat(&psi, "psi:");
+      for (i=0; i<psiCount; i++) {
+         if (psiVal[i]>=0)
+            strPrintf(&psi, "%s%c%i", (psi.len>4) ? "/" : "", psiLetter[i], psiVal[i]);
+      }
+      strCat(&psi, "%");
+   }
+   return elementSet(&st->element[elCpu], &cpu) | elementSet(&st->element[elMem], &mem) | elementSet(&st->element[elPsi], &psi);
+}
+
+/* Called on link, address and wifi events, and from updateWifi() */
+static int updateNet(si_state *st) {
+   si_str net;
+
+   strInit(&net);
+   if (st->rtnl.fd>=0)
+      getNetwork(&net, &st->rtnl, &st->nlData, &st->wStats);
+   return elementSet(&st->element[elNet], &net);
+}
+
+/* Periodic wifi signal refresh: mark all cached levels stale so station dumps are started */
+static int updateWifi(si_state *st) {
+   int i;
+
+   for (i=0; i<st->nlData.n; i++)
+      st->nlData.wIfs[i].stale=1;
+   return updateNet(st);
+}
+
+/* Drop the cached signal of interfaces that are gone: a replugged wifi adapter comes back with a new ifindex */
+static void wifiPrune(si_nlData *nlData, si_rtnl *rtnl) {
+   int i;
+
+   for (i=0; i<nlData->n; i++) {
+      if (rtnlIfLookup(rtnl, nlData->wIfs[i].ifindex, 0)==NULL)
+         nlData->wIfs[i--]=nlData->wIfs[--nlData->n];
+   }
+}
+
+/* Netlink reports socket overrun as EPOLLERR: rtnlEvent() resyncs the interface table.
+ * The network element is only recomputed if the displayed network status changed.
+ */
+static int rtnlSourceEvent(si_state *st, si_source *src, uint32_t events) {
+   int r=rtnlEvent(&st->rtnl);
+
+   if (r==-1) {
+      evDel(src);
+      close(st->rtnl.fd);
+      st->rtnl.fd=-1;
+   }
+   if (r>0)
+      wifiPrune(&st->nlData, &st->rtnl);
+   return (r!=0) ? updateNet(st) : 0;
+}
+
+static int nlEvent(si_state *st, si_source *src, uint32_t events) {
+   st->nlData.changed=0;
+   nl_recvmsgs(st->nlData.evSocket, st->nlData.ev_cb);
+   return (st->nlData.changed) ? updateNet(st) : 0;
+}
+
+static int nlQueryEvent(si_state *st, si_source *src, uint32_t events) {
+   return wifiQueryRecv(&st->nlData, &st->wStats) ? updateNet(st) : 0;
+}
+
+/* Results of the collector thread */
+static int collectorEvent(si_state *st, si_source *src, uint32_t events) {
+   si_netIf *netIf;
+   si_probe p;
+   uint64_t n;
+   int i, refresh=0, net=0;
+
+   if (read(src->fd, &n, sizeof(n))==-1 && errno!=EAGAIN)
+      perror("collectorEvent: read");
+   if (__atomic_exchange_n(&collector.ethLost, 0, __ATOMIC_ACQ_REL)) {
+      for (i=0; i<st->rtnl.n; i++)
+         st->rtnl.ifs[i].stale=1;
+      net=1;
+   }
+   while (ringGet(&collector.res, &p)==0) {
+      if (p.type==probeTmp) {
+         if (strcmp(p.path, st->devs.thermal.path)==0)   /* Not a reply for a sensor since removed */
+            refresh|=showTmp(st, p.value);
+      }
+      else if ((netIf=rtnlIfLookup(&st->rtnl, p.ifindex, 0))!=NULL && strncmp(netIf->name, p.name, IFNAMSIZ)==0) {
+         memcpy(netIf->displayStatus, p.displayStatus, ETH_STATUS_LEN);
+         netIf->speed=p.speed;
+         net=1;
+      }
+   }
+   if (net)
+      refresh|=updateNet(st);
+   return refresh;
+}
+
+static int endNotify(si_state *st) {
+   int i;
+
+   for (i=0; i<LENGTH(st->udevDisplayInfo); i++)
+      textSet(&st->udevDisplayInfo[i], "", 0);
+   textSet(&st->notifyText, "", 0);
+   st->notifying=0;
+   return 1;
+}
+
+/* Notifications replace the status line for NOTIFY_TIMEOUT. Bursts of events (a volume slider dragged,
+ * the backlight key held down) are coalesced: events only update the latest value of each udev slot and
+ * mixer element, and at most one notification is output per COALESCE_WINDOW.
+ * Returns 1 if a notification was output (notification block), 0 if none, -1 on output error.
+ */
+static int notifyEmit(si_state *st) {
+   si_str udev, alsa;
+   int i;
+
+   strInit(&udev);
+   strInit(&alsa);
+   if (st->notifyPending & notifyUdev) {
+      for (i=0; i<LENGTH(st->udevDisplayInfo); i++) {
+         if (st->udevDisplayInfo[i].len>0) {
+            strAppend(&udev, TEXT(st->udevDisplayInfo[i]), st->udevDisplayInfo[i].len);
+            strAppend(&udev, &si_separator, 1);
+         }
+      }
+   }
+   if (st->notifyPending & notifyAlsa) {
+      for (i=0; i<LENGTH(mixerElems); i++) {
+         if (mixerElems[i].changed) {
+            if (alsa.len>0)
+               strAppend(&alsa, &si_separator, 1);
+            strAppend(&alsa, TEXT(mixerElems[i].text), mixerElems[i].text.len);
+            mixerElems[i].changed=0;
+         }
+      }
+   }
+   st->notifyPending=0;
+   strAppend(&udev, alsa.s, alsa.len);
+   if (udev.len==0 || policy.blanked)   /* Not shown later either: it would be stale when the backlight comes on */
+      return 0;
+
+   textSet(&st->notifyText, udev.s, udev.len);
+   st->notifying=1;
+   schedArm(&timers[timerNotify], cfg.notifyTimeout);
+   schedArm(&timers[timerCoalesce], cfg.coalesceWindow);
+   return (sbOut(udev.s)==-1) ? -1 : 1;
+}
 
-   nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
-             genlmsg_attrlen(gnlh, 0), NULL);
+/* End of a coalescing window: output the events received during it. -1 (output error) exits, as from
+ * the main loop
+ */
+static int notifyFlush(si_state *st) {
+   return (st->notifyPending) ? notifyEmit(st) : 0;
+}
 
-   /* This comment is retained from iw; station.c
-    * TODO: validate the interface and mac address!
-    * Otherwise, there's a race condition as soon as
-    * the kernel starts sending station notifications.
-    */
+/* Compose st->statusLine from the status elements; only rebuilt if an element changed since last time */
+void getStatusInfo(si_state *st) {
+   int i, changed=0;
+   si_str line;
 
-   if (!tb[NL80211_ATTR_STA_INFO]) {
-     fprintf(stderr, "sta stats missing!\n");
-     return NL_SKIP;
+   for (i=0; i<elStatusCount; i++) {
+      if (st->composed[i]!=st->element[i].version) {
+         st->composed[i]=st->element[i].version;
+         changed=1;
+      }
    }
+   if (!changed && st->composedSeparator==si_separator)
+      return;
 
-   if (nla_parse_nested(sinfo, NL80211_STA_INFO_MAX, tb[NL80211_ATTR_STA_INFO], stats_policy)) {
-     fprintf(stderr, "failed to parse nested attributes!\n");
-     return NL_SKIP;
+   st->composedSeparator=si_separator;
+   strInit(&line);
+   for (i=0; i<elStatusCount; i++) {
+      strAppend(&line, TEXT(st->element[i].text), st->element[i].text.len);
+      if (st->element[i].text.len>0 && (EL_SEPARATED & 1u<<i))
+         strAppend(&line, &si_separator, 1);
    }
+   textSet(&st->statusLine, line.s, line.len);
+}
 
-   if (sinfo[NL80211_STA_INFO_SIGNAL]) {
-     ((si_wStats*)arg)->signal = (int8_t)nla_get_u8(sinfo[NL80211_STA_INFO_SIGNAL]);
+/* Append len characters of src to b as a JSON string body */
+static void jsonEscape(si_str *b, const char *src, size_t len) {
+   for (; len>0; src++, len--) {
+      if (*src=='"' || *src=='\\')
+         strPrintf(b, "\\%c", *src);
+      else if ((unsigned char)*src<0x20)
+         strPrintf(b, "\\u%04x", *src);
+      else
+         strAppend(b, src, 1);
    }
-   else
-    ((si_wStats*)arg)->signal = 0;
-
-   return NL_SKIP;
 }
 
-/* If using ss -f netlink to view sockets created by this program, port number will not be process ID. From libnl docs:
- * "...it was common practice to use the process identifier (PID) as the local port number. This became unpractical
- * with the introduction of threaded netlink applications and applications requiring multiple sockets. Therefore libnl
- * generates unique port numbers based on the process identifier and adds an offset to it allowing for multiple
- * sockets to be used."
+/* Render the i3bar / swaybar protocol block of each status element and the notification. Separators
+ * are left to the bar, a low battery ("[!]") is marked urgent, and with a history shown the
+ * temperature and power blocks carry its aggregates.
+ * Returns a mask of the blocks that changed since the last call.
  */
-static int init_nl80211(si_nlData *nlData, si_wStats *w) {
-   nlData->id=-1;
-   nlData->socket = nl_socket_alloc();
-   if (!nlData->socket) {
-      fprintf(stderr, "Failed to allocate netlink socket.\n");
-      return -1;
-   }
-   nl_socket_set_buffer_size(nlData->socket, 8192, 8192);
+static unsigned int jsonRender(si_state *st) {
+   si_str buf;
+   const char *s;
+   size_t len;
+   unsigned int i, changed=0;
+   int j, n;
 
-   if (genl_connect(nlData->socket)) {
-      fprintf(stderr, "Failed to connect to netlink socket.\n");
-      nl_close(nlData->socket);
-      nl_socket_free(nlData->socket);
-      return -1;
+   for (i=0; i<blkCount; i++) {
+      s=(i==blkNotify) ? TEXT(st->notifyText) : TEXT(st->element[i].text);
+      len=strlen(s);
+      while (len>0 && (s[len-1]==' ' || (i==blkNotify && s[len-1]==si_separator)))   /* net spaces its interfaces */
+         len--;
+      strInit(&buf);
+      strPrintf(&buf, "{\"name\":\"%s\",", blocks[i].name);
+      if (blocks[i].batteries && st->devs.nSupplies>0) {
+         strCat(&buf, "\"instance\":\"");
+         for (j=0, n=0; j<st->devs.nSupplies; j++) {
+            if (st->devs.supplies[j].battery)
+               strPrintf(&buf, "%s%s", (n++>0) ? "+" : "", st->devs.supplies[j].name);
+         }
+         strCat(&buf, "\",");
+      }
+      if (blocks[i].history==1 && cfg.history)
+         historyJson(&buf, &st->tmpHistory, 1000, 0);
+      else if (blocks[i].history==2 && cfg.history)
+         historyJson(&buf, &st->pwrHistory, 1000000, 1);
+      strCat(&buf, "\"full_text\":\"");
+      jsonEscape(&buf, s, len);
+      strPrintf(&buf, "\"%s}", (strncmp(s, "[!]", 3)==0) ? ",\"urgent\":true" : "");
+      blocks[i].shown=(len>0);
+      if (textSet(&blocks[i].json, buf.s, buf.len)==1)
+         changed|=1u<<i;
    }
+   return changed;
+}
 
-   nlData->id = genl_ctrl_resolve(nlData->socket, "nl80211");
-   if (nlData->id<0) {
-      fprintf(stderr, "Nl80211 interface not found.\n");
-      nl_close(nlData->socket);
-      nl_socket_free(nlData->socket);
-      return -1;
-   }
+/* Scheduler: one deadline per module, all served by a single CLOCK_BOOTTIME timerfd armed to the
+ * earliest deadline. CLOCK_BOOTTIME keeps counting while the system is suspended, so timers that came
+ * due while asleep expire as soon as it resumes (see lifecycleCheck()). Timers due within SCHED_SLACK of
+ * each other run on the same wakeup: the timerfd is armed to the last of them, so a timer may run up to
+ * SCHED_SLACK late but never early (the clock has its own wall clock timer: see clockArm()). There are
+ * only a handful of timers, so the earliest is found with a linear scan.
+ */
+static si_timer timers[timerCount] = {
+   /* update function, interval (ms), scaled by the refresh policy */
+   [timerTmp]    = { updateTmp,   TEMP_INTERVAL,          1 },
+   [timerBat]    = { updateBat,   BATTERY_INTERVAL,       1 },
+   [timerNet]    = { updateWifi,  WIFI_STATION_INTERVAL,  1 },
+   [timerProc]   = { updateProc,  PROC_INTERVAL,          1 },
+   [timerPolicy] = { policyUpdate, POLICY_INTERVAL },
+   [timerNotify] = { endNotify,   0 },
+   [timerCoalesce] = { notifyFlush, 0 },
+   [timerDwlb]   = { dwlbRetry,   0 },
+};
 
-   nlData->wlanStats_cb = nl_cb_alloc(NL_CB_DEFAULT);
-   if ( ! nlData->wlanStats_cb) {
-      fprintf(stderr, "Failed to allocate netlink callback.\n");
-      nl_close(nlData->socket);
-      nl_socket_free(nlData->socket);
-      return -1;
+static void timespecAddMs(struct timespec *t, long ms) {
+   t->tv_sec+=ms/1000;
+   t->tv_nsec+=(ms%1000)*1000000;
+   if (t->tv_nsec>=1000000000) {
+      t->tv_sec++;
+      t->tv_nsec-=1000000000;
    }
+   else if (t->tv_nsec<0) {
+      t->tv_sec--;
+      t->tv_nsec+=1000000000;
+   }
+}
 
-   nl_cb_set(nlData->wlanStats_cb, NL_CB_VALID , NL_CB_CUSTOM, getWifiStats_nl_cb, w);
-   nl_cb_set(nlData->wlanStats_cb, NL_CB_FINISH, NL_CB_CUSTOM, finish_handler, &(nlData->wlanStatsResult));
-   nl_cb_set(nlData->wlanStats_cb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, NULL);
+/* 1 if a is before b */
+static int timespecBefore(const struct timespec *a, const struct timespec *b) {
+   return a->tv_sec<b->tv_sec || (a->tv_sec==b->tv_sec && a->tv_nsec<b->tv_nsec);
+}
 
-   return nlData->id;
+/* Arm timer to expire ms from now */
+static void schedArm(si_timer *t, long ms) {
+   clock_gettime(CLOCK_BOOTTIME, &t->due);
+   timespecAddMs(&t->due, ms);
+   t->armed=1;
 }
 
-static int getWifiStatus(si_nlData *nlData, si_wStats *wStats) {
-   if (wStats->ifindex < 0)
-      return -1;
+/* Run expired timers and re-arm periodic ones. Returns 1 if any module needs the status output */
+static int schedRun(si_state *st) {
+   struct timespec now;
+   int i, ret, refresh;
 
-   struct nl_msg* msg = nlmsg_alloc();
-   if (!msg) {
-      fprintf(stderr, "Failed to allocate netlink message.\n");
-      return -2;
+   refresh=lifecycleCheck(st);   /* After resume: all timers are due now */
+   clock_gettime(CLOCK_BOOTTIME, &now);
+   for (i=0; i<timerCount; i++) {
+      if (!timers[i].armed || timespecBefore(&now, &timers[i].due))
+         continue;
+      timers[i].armed=0;
+      if (timers[i].interval>0)
+         schedArm(&timers[i], timers[i].interval);
+      ret=timers[i].func(st);
+      if (ret==-1)
+         return -1;
+      refresh|=ret;
    }
+   return refresh;
+}
 
-   nlData->wlanStatsResult=1;
-   genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, nlData->id, 0, NLM_F_DUMP, NL80211_CMD_GET_STATION, 0);
-   nla_put_u32(msg, NL80211_ATTR_IFINDEX, wStats->ifindex);
-   nl_send_auto(nlData->socket, msg);
-   while (nlData->wlanStatsResult > 0) /* Wait for NL_CB_FINISH */
-      nl_recvmsgs(nlData->socket, nlData->wlanStats_cb);
-   nlmsg_free(msg);
+static int schedEvent(si_state *st, si_source *src, uint32_t events) {
+   uint64_t expirations;
 
-  return 0;
+   if (read(src->fd, &expirations, sizeof(expirations))==-1 && errno!=EAGAIN)
+      perror("read timerfd");
+   return schedRun(st);
 }
 
-/* Ethtool: notes in /usr/include/linux/ethtool.h
- * Also see ethtool.c do_ioctl_glinksettings().
- * ifr struct in man 7 netdevice
- * Note: ETHTOOL_GSET is depreciated. Use ETHTOOL_GLINKSETTINGS.
+/* Arm timer_fd for the last timer deadline within SCHED_SLACK of the earliest one */
+static void schedUpdate(int timer_fd) {
+   struct itimerspec its;
+   struct timespec limit;
+   const struct timespec *due=NULL;
+   int i;
+
+   for (i=0; i<timerCount; i++) {
+      if (timers[i].armed && (due==NULL || timespecBefore(&timers[i].due, due)))
+         due=&timers[i].due;
+   }
+   memset(&its, 0, sizeof(its));
+   if (due!=NULL) {
+      limit=*due;
+      timespecAddMs(&limit, SCHED_SLACK);
+      for (i=0; i<timerCount; i++) {
+         if (timers[i].armed && timespecBefore(due, &timers[i].due) && !timespecBefore(&limit, &timers[i].due))
+            due=&timers[i].due;
+      }
+      its.it_value=*due;
+      if (its.it_value.tv_sec==0 && its.it_value.tv_nsec==0)
+         its.it_value.tv_nsec=1;    /* All zero would disarm the timer */
+   }
+   if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL)==-1)
+      perror("schedUpdate(): timerfd_settime");
+}
+
+/* Refresh policy: the scaled timers (timers[] above) run policy.scale times less often on battery, on
+ * low battery and with the backlight dimmed, and are suspended with the clock while the backlight is off,
+ * when nobody is looking at the bar. Network and notification events are still received, but nothing is
+ * output until the backlight comes back on. The power state is read on POLICY_INTERVAL and on adapter and
+ * backlight events (sysDevEvent()).
  */
-static void getEthernetStatus(char *name, char *displayStatus) {
-   int fd;
-   struct ifreq ifr;
-   struct {
-      struct ethtool_link_settings req;
-      __u32 link_mode_data[3*SCHAR_MAX];   /* Store for 3x link mode bitmaps (supported, advertising, lp_advertising) - not used here. In ethtool.c size is (3 x ETHTOOL_LINK_MODE_MASK_MAX_KERNEL_NU32); ethtool internal.h defines ETHTOOL_LINK_MODE_MASK_MAX_KERNEL_NU32 as SCHAR_MAX on linux. SCHAR_MAX is defined in limits.h */
-   } ecmd;
-   unsigned int ifindex;
+/* 1 if an adapter is online, 0 if none is, -1 if no adapter reports it */
+static int adapterOnline(si_sysDevs *d) {
+   int i, online=-1;
+   long v;
 
-   fd=socket(AF_INET, SOCK_DGRAM, 0);
-   if (fd==-1) {
-      displayStatus[0]='\0';
-      perror("getEthernetStatus()");
-      return;
+   for (i=0; i<d->nSupplies; i++) {
+      if (d->supplies[i].battery || (v=getSysInfo(&d->supplies[i].online))<0)
+         continue;
+      if (v>0)
+         return 1;
+      online=0;
    }
-   ifindex=if_nametoindex(name);
+   return online;
+}
 
-   memset(&ecmd, 0, sizeof(ecmd));        /* Set all fields of ecmd.req to zero */
-   ecmd.req.cmd = ETHTOOL_GLINKSETTINGS;  /* Set required command */
-   memset(&ifr, 0, sizeof(ifr));
-   strncpy(ifr.ifr_name, name, IFNAMSIZ); /* Set name of interface we are interested in */
-   ifr.ifr_name[IFNAMSIZ-1]='\0';
-   ifr.ifr_data = (void*)&ecmd;
-   if (ioctl(fd, SIOCETHTOOL, &ifr) != -1) {       /* Send all fields zero except cmd to request link mode data size from kernel */
-      if (ecmd.req.link_mode_masks_nwords < 0) {   /* Field returned negative to indicate requested size (i.e. 0) unsupported; absolute value is the supported size */
-         ecmd.req.cmd = ETHTOOL_GLINKSETTINGS;     /* Now get the real data using returned link_mode_masks_nwords size */
-         ecmd.req.link_mode_masks_nwords = -ecmd.req.link_mode_masks_nwords;
-         if (ioctl(fd, SIOCETHTOOL, &ifr) != -1) {
-            snprintf(displayStatus, 16, "%c%i:%iM ", name[0], ifindex, ecmd.req.speed);
-         }
+static void policySuspend(si_state *st) {
+   struct itimerspec its;
+   int i;
+
+   for (i=0; i<timerCount; i++) {
+      if (timers[i].scaled)
+         timers[i].armed=0;
+   }
+   memset(&its, 0, sizeof(its));
+   if (st->clock.fd>=0 && timerfd_settime(st->clock.fd, 0, &its, NULL)==-1)
+      perror("policySuspend(): timerfd_settime");
+   if (st->devs.mon!=NULL && st->devs.monSrc==NULL)   /* Backlight events wake us: see sysDevDrain() */
+      st->devs.monSrc=evAdd(udev_monitor_get_fd(st->devs.mon), EPOLLIN, sysDevWake, NULL);
+}
+
+/* Backlight on again: every element is refreshed now and the timers restart */
+static int policyResume(si_state *st) {
+   int i;
+
+   evDel(st->devs.monSrc);
+   st->devs.monSrc=NULL;
+   for (i=0; i<timerCount; i++) {
+      if (timers[i].scaled) {
+         schedArm(&timers[i], timers[i].interval);
+         timers[i].func(st);
       }
    }
-   else {
-      snprintf(displayStatus, 16, "%c(%i):err", name[0], ifindex);
-      fprintf(stderr, "%s (index %i):", ifr.ifr_name, ifindex);
-      perror("getEthernetStatus()");
+   if (st->clock.fd>=0) {
+      st->clock.shown=-1;
+      clockArm(&st->clock);
    }
-   close(fd);
+   updateClock(st);
+   updateNet(st);
+   return 1;   /* The status held while blanked is output even if unchanged */
 }
 
-/* ifa_flags are defined in: man 7 netdevice
- * sa_family is defined in: man 2 socket
- * examples in man 3 getifaddrs
+/* Read the power state and apply the policy if it changed: the scaled timers keep their last run time,
+ * so a shorter interval takes effect at once. Returns 1 if the status needs to be output
  */
-static void getNetwork(char *displayText, si_nlData *nlData, si_wStats *wStats) {
-   struct ifaddrs *ifaddr;
-   char displayStatus[16];
-   int i=MX_ELEMENT_CHARS-1;   /* Maximum length of displayText excluding terminating NULL char */
-   int j=0, n=0;
-   char *names[16];
-   
-   if (getifaddrs(&ifaddr) == -1) {
-      perror("getifaddrs");
-      return;
-   }
+static int policyUpdate(si_state *st) {
+   si_sysDevs *d=&st->devs;
+   si_policy p=policy;
+   long brightness, interval;
+   int i, online, resume, batteries=0;
 
-   memset(names, 0, 16*sizeof(char*));
-  /* Walk through linked list, maintaining head pointer so we can free list later.*/
-   for (struct ifaddrs *ifa = ifaddr; ifa != NULL && i>0; ifa = ifa->ifa_next) {
-      if (ifa->ifa_addr == NULL || ifa->ifa_flags&IFF_LOOPBACK || ifa->ifa_flags&IFF_POINTOPOINT)
-         continue;
+   d->powerState=0;
+   for (i=0; i<d->nSupplies; i++)
+      batteries+=d->supplies[i].battery;
+   online=adapterOnline(d);
+   p.onBattery=(batteries>0 && ((online>=0) ? !online : batteryDirection(d)<0));
+   p.lowBattery=(p.onBattery && d->capacity>=0 && d->capacity<=cfg.batteryLow);
+   brightness=getSysInfo(&d->backlight.brightness);   /* -1 if there is no backlight */
+   p.blanked=(brightness==0 || getSysInfo(&d->backlight.power)>0);   /* bl_power: 0 is FB_BLANK_UNBLANK */
+   p.dimmed=(brightness>0 && brightness*100<=cfg.policyDimLevel*d->backlight.max);
+   p.scale=1;
+   if (p.onBattery)
+      p.scale*=cfg.policyBattery;
+   if (p.lowBattery)
+      p.scale*=cfg.policyLowBattery;
+   if (p.dimmed)
+      p.scale*=cfg.policyDim;
+   if (memcmp(&p, &policy, sizeof(p))==0)
+      return 0;
 
-      if (ifa->ifa_addr->sa_family==AF_INET || ifa->ifa_addr->sa_family==AF_INET6) {
-         if (ifa->ifa_flags&IFF_RUNNING) {
-            /* Match interfaces; getifaddrs() returns struct per address - we only
-             * want to report the interface once
-             */
-            for (j=0; j<n && names[j]!=NULL; j++) {
-               if (strcmp(ifa->ifa_name, names[j])==0)
-                  break;
-            }
-            if (j<n) /* Already have this interface */
-               continue;
-            names[n]=ifa->ifa_name;
-            if (n<15) n++;
-            //printf("%i: Name: %s\n",n,names[j]);
-            //printf("%s: Up\n", ifa->ifa_name);
-            /* Select interfaces for display: assume 'e' for ethernet, 'b' for bridge interfaces, 'w' for wireless */
-            if (ifa->ifa_name[0]=='e' || ifa->ifa_name[0]=='b')
-               getEthernetStatus(ifa->ifa_name, displayStatus);
-            if (ifa->ifa_name[0]=='w' && nlData->id>=0) {
-               wStats->ifindex=if_nametoindex(ifa->ifa_name);
-               getWifiStatus(nlData, wStats);
-               snprintf(displayStatus, 16, "w%i:%ddBm ", wStats->ifindex, wStats->signal);
-            }
-            strncat(displayText, displayStatus, i);   /* Always adds '\0' */
-            i-=strlen(displayStatus);
-            if (i<0)
-               break; /* Too much data */
-         }
-         //else
-            //printf("%s: Down\n", ifa->ifa_name);
-      }
+   if (p.blanked!=policy.blanked)
+      fprintf(stderr, "statusInfo: INFO: backlight %s\n", p.blanked ? "off: updates suspended" : "on: updates resumed");
+   if (p.scale!=policy.scale)
+      fprintf(stderr, "statusInfo: INFO: refresh intervals x%li (%s%s%s)\n", p.scale, p.onBattery ? "on battery" : "on mains",
+            p.lowBattery ? ", low battery" : "", p.dimmed ? ", backlight dimmed" : "");
+   if (p.blanked && !policy.blanked)
+      policySuspend(st);
+   resume=(!p.blanked && policy.blanked);
+   policy=p;
+   for (i=0; i<timerCount; i++) {
+      if (!timers[i].scaled)
+         continue;
+      interval=cfg.interval[i]*policy.scale;
+      if (timers[i].armed)
+         timespecAddMs(&timers[i].due, interval-timers[i].interval);
+      timers[i].interval=interval;
    }
-   freeifaddrs(ifaddr);
+   return resume ? policyResume(st) : 0;
 }
 
-static void setXorgBarText(char *str) {
-   XStoreName(dpy, DefaultRootWindow(dpy), str);
-   XSync(dpy, False);
+/* Suspend / resume: CLOCK_BOOTTIME advances while the system is suspended and CLOCK_MONOTONIC does not,
+ * so the growth of their difference is the time spent asleep. It is checked on each scheduler wakeup,
+ * and the scheduler wakes at once on resume (CLOCK_BOOTTIME timerfd, and the policy timer is always
+ * armed). Devices and interfaces that come or go while asleep are reported by their udev and rtnetlink
+ * events as usual; only what those do not cover is revalidated here.
+ */
+static long long asleepNs;   /* CLOCK_BOOTTIME - CLOCK_MONOTONIC at the last check */
+
+static long long sleepTime(void) {
+   struct timespec b, m;
+
+   clock_gettime(CLOCK_BOOTTIME, &b);
+   clock_gettime(CLOCK_MONOTONIC, &m);
+   return (b.tv_sec-m.tv_sec)*1000000000LL+b.tv_nsec-m.tv_nsec;
 }
 
-/* The code below is taken from dwlb, called when the -status command is given in dwlb.
+/* Resync after resume: drop the system devices gone while asleep (their remove event can be lost in a
+ * monitor overrun), re-probe link speeds (renegotiated) and start over the power model, then run every
+ * periodic timer now rather than when it comes due. Returns 1 if the status needs to be output
  */
+static int lifecycleResume(si_state *st, long long ns) {
+   int i;
 
-/* Returns -1 on error or number of bytes sent */
-static int dwlbSend(struct sockaddr_un *sock_address, const char *output, const char *cmd, const char *data) {
-   size_t len;
-   char sockbuf[4096];
-   int r;
-   int sock_fd;
+   fprintf(stderr, "statusInfo: INFO: resumed after %llis: refreshing\n", (ns+500000000)/1000000000);
+   sysDevRevalidate(&st->devs);
+   st->devs.power.n=0;   /* Readings from before the suspend */
+   ethInvalidate(0);
+   for (i=0; i<st->rtnl.n; i++)
+      st->rtnl.ifs[i].stale=1;
+   for (i=0; i<timerCount; i++) {
+      if (timers[i].interval>0 && timers[i].armed)   /* Periodic, not suspended by the policy */
+         schedArm(&timers[i], 0);   /* Wifi signal: station dumps started by updateWifi() */
+   }
+   st->clock.shown=-1;
+   return updateClock(st) | updateNet(st);
+}
 
-   if (data!=NULL)
-      snprintf(sockbuf, sizeof(sockbuf), "%s %s %s", output, cmd, data);
-   else
-      snprintf(sockbuf, sizeof(sockbuf), "%s %s", output, cmd);
+/* Returns 1 if the status needs to be output */
+static int lifecycleCheck(si_state *st) {
+   long long t=sleepTime(), slept=t-asleepNs;
+
+   asleepNs=t;
+   return (slept>=SLEEP_RESYNC*1000000LL) ? lifecycleResume(st, slept) : 0;
+}
 
-   len=strlen(sockbuf);
+int dwlbSocketInit(long dwlb_ref) {
+   char *xdgRunTimeDir;
 
-   sock_fd=socket(sock_address->sun_family, SOCK_STREAM, 1);
-   if (sock_fd==-1) {
-      perror("dwlbSend: Opening socket");
+   if (!(xdgRunTimeDir=getenv("XDG_RUNTIME_DIR"))) {
+      fprintf(stderr, "dwlbSocketInit: Could not retrieve XDG_RUNTIME_DIR\n");
       return -1;
    }
+   dwlbConn.addr.sun_family=AF_UNIX;
+   snprintf(dwlbConn.addr.sun_path, sizeof (dwlbConn.addr.sun_path), "%s/dwlb/dwlb-%li", xdgRunTimeDir, dwlb_ref);
+   fprintf(stderr, "dwlbSocketInit: using dwlb socket on %s\n", dwlbConn.addr.sun_path);
 
-   r=connect(sock_fd, (struct sockaddr *) sock_address, sizeof(*sock_address));
-   if (r==-1) {
-      perror("dwlbSend:connect");
+   return 0;
+}
+
+/* Socket sink: a listening UNIX socket; every subscriber gets the current status when it connects and
+ * then one line per update. A subscriber that is not reading (socket buffer full) is dropped rather than
+ * delaying the other outputs.
+ */
+/* Socket address from path, or the default $XDG_RUNTIME_DIR/statusInfo.sock if path is NULL */
+static int sockAddress(struct sockaddr_un *addr, const char *path) {
+   char *xdgRunTimeDir;
+
+   addr->sun_family=AF_UNIX;
+   if (path==NULL) {
+      if (!(xdgRunTimeDir=getenv("XDG_RUNTIME_DIR"))) {
+         fprintf(stderr, "statusInfo: Could not retrieve XDG_RUNTIME_DIR\n");
+         return -1;
+      }
+      snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/statusInfo.sock", xdgRunTimeDir);
+   }
+   else
+      snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", path);
+   return 0;
+}
+
+static int sockSinkInit(const char *path) {
+   int fd;
+
+   if (sockAddress(&sockSink.addr, path)==-1)
+      return -1;
+
+   fd=socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+   if (fd==-1) {
+      perror("sockSinkInit: socket");
+      return -1;
+   }
+   if (connect(fd, (struct sockaddr *)&sockSink.addr, sizeof(sockSink.addr))==0) {
+      fprintf(stderr, "sockSinkInit: %s is in use by another statusInfo\n", sockSink.addr.sun_path);
+      close(fd);
+      return -1;
+   }
+   unlink(sockSink.addr.sun_path);   /* Stale socket from a previous run */
+   if (bind(fd, (struct sockaddr *)&sockSink.addr, sizeof(sockSink.addr))==-1 || listen(fd, 8)==-1) {
+      perror("sockSinkInit");
+      close(fd);
       return -1;
    }
+   sockSink.fd=fd;
+   fprintf(stderr, "sockSinkInit: status published on %s\n", sockSink.addr.sun_path);
+   return 0;
+}
 
-   r=send(sock_fd, sockbuf, len, 0);
-   if (r==-1)
-      perror("dwlbSend:send");
+static void sockSinkDrop(int i) {
+   close(sockSink.clients[i]);
+   sockSink.clients[i]=sockSink.clients[--sockSink.n];
+}
 
-   close(sock_fd);
-   return r;
+/* Write line to client i; the client is dropped on error or if the line does not fit in its buffer */
+static void sockSinkWrite(int i, const char *status) {
+   struct iovec iov[2]={ { (void *)status, strlen(status) }, { "\n", 1 } };
+   struct msghdr msg={ .msg_iov=iov, .msg_iovlen=2 };
+
+   statSyscall(statSink+sock);
+   if (sendmsg(sockSink.clients[i], &msg, MSG_NOSIGNAL|MSG_DONTWAIT) != (ssize_t)(iov[0].iov_len+1))
+      sockSinkDrop(i);
 }
 
-static void getTime(char *buf, char *fmt) {
-   time_t ctime;
-   struct tm *ltime;
+/* New subscriber on the listening socket: it gets the current status first (all blocks, or the status
+ * line, not a notification being shown), then the updates
+ */
+static int sockSinkAccept(si_state *st, si_source *src, uint32_t events) {
+   int fd, i, n;
 
-   ctime=time(NULL);
-   ltime=localtime(&ctime);
-   if (ltime!=NULL) {
-      if (strftime(buf, MX_ELEMENT_CHARS, fmt, ltime)==0)
-         snprintf(buf, MX_ELEMENT_CHARS, "[clock format error]");
+   fd=accept4(sockSink.fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+   if (fd==-1)
+      return 0;
+   if (sockSink.n>=MX_SOCK_CLIENTS) {
+      fprintf(stderr, "sockSinkAccept: too many clients\n");
+      close(fd);
+      return 0;
    }
-   else
-      snprintf(buf, MX_ELEMENT_CHARS, "[clock error]");
+   sockSink.clients[sockSink.n++]=fd;
+   n=sockSink.n;
+   if (jsonOutput) {   /* All blocks, stopping if the client was dropped */
+      for (i=0; i<blkCount && sockSink.n==n && sockSink.clients[n-1]==fd; i++)
+         sockSinkWrite(n-1, TEXT(blocks[i].json));
+   }
+   else if (st->statusLine.len>0)
+      sockSinkWrite(sockSink.n-1, TEXT(st->statusLine));
+   return 0;
+}
+
+static int sockSinkSend(const char *status) {
+   int i;
 
-   buf[MX_ELEMENT_CHARS-1]='\0';
+   for (i=sockSink.n-1; i>=0; i--)
+      sockSinkWrite(i, status);
+   return 0;
 }
 
-long getSysInfo(char *sysPath) {
-   FILE *fd;
-   long sysInfo=-1;
+/* Structured output: one line per changed block */
+static int sockSinkSendJson(unsigned int changed) {
+   int i, j;
 
-   fd = fopen(sysPath, "r");
-   if (fd != NULL) {
-      fscanf(fd, "%li", &sysInfo);
-      fclose(fd);
+   for (i=0; i<blkCount; i++) {
+      if (changed & 1u<<i) {
+         for (j=sockSink.n-1; j>=0; j--)
+            sockSinkWrite(j, TEXT(blocks[i].json));
+      }
    }
+   return 0;
+}
 
-   return sysInfo;
+static void sockSinkClose(void) {
+   while (sockSink.n>0)
+      sockSinkDrop(0);
+   if (sockSink.fd>=0) {
+      close(sockSink.fd);
+      unlink(sockSink.addr.sun_path);
+   }
 }
 
-long getTmpInfo(char *sysfsThermalPath) {
-   long tmp;
+/* Shared memory snapshot (-m): layout in statusInfo-shm.h */
+static int shmInit(void) {
+   char *xdgRunTimeDir, tmpPath[MX_PATH_LEN+16];
+   void *p;
+   int fd;
 
-   tmp=getSysInfo(sysfsThermalPath);
-   if (tmp!=-1)
-      return tmp/1000;
-   else
+   if (!(xdgRunTimeDir=getenv("XDG_RUNTIME_DIR"))) {
+      fprintf(stderr, "shmInit: Could not retrieve XDG_RUNTIME_DIR\n");
+      return -1;
+   }
+   /* A segment left by another instance may still be mapped by its readers (or written by its
+    * writer): a new one is created and initialised under a private name, then renamed into place
+    */
+   snprintf(shmPath, MX_PATH_LEN, "%s/%s", xdgRunTimeDir, SI_SHM_FILE);
+   snprintf(tmpPath, sizeof(tmpPath), "%s.%d", shmPath, (int)getpid());
+   unlink(tmpPath);   /* Left by a crashed instance with the same pid */
+   fd=open(tmpPath, O_RDWR|O_CREAT|O_EXCL|O_CLOEXEC, 0644);
+   if (fd==-1 || ftruncate(fd, sizeof(si_shm))==-1) {
+      perror("shmInit");
+      if (fd>=0) {
+         close(fd);
+         unlink(tmpPath);
+      }
+      return -1;
+   }
+   p=mmap(NULL, sizeof(si_shm), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (p==MAP_FAILED) {
+      perror("shmInit: mmap");
+      unlink(tmpPath);
+      return -1;
+   }
+   shm=p;   /* Zero filled by ftruncate() */
+   shm->size=sizeof(si_shm);
+   shm->batCapacity=shm->batPowerNow=shm->temperature=-1;
+   __atomic_store_n(&shm->version, SI_SHM_VERSION, __ATOMIC_RELEASE);
+   if (rename(tmpPath, shmPath)==-1) {
+      perror("shmInit: rename");
+      munmap(shm, sizeof(si_shm));
+      shm=NULL;
+      unlink(tmpPath);
       return -1;
+   }
+   fprintf(stderr, "shmInit: status values published in %s\n", shmPath);
+   return 0;
 }
 
-void getStatusInfo(char *sBuf, char *sysfsBatteryCapacity, char *sysfsBatteryPowerNow, char *sysfsThermalPath, si_nlData *nlData, si_wStats *wStats) {
-   long batCapacityNow;
-   long powerNow;
-   char net[MX_ELEMENT_CHARS];
-   char tmp[MX_ELEMENT_CHARS];
-   char pwr[MX_ELEMENT_CHARS];
-   char bat[MX_ELEMENT_CHARS];
-   char tml[MX_ELEMENT_CHARS];
-
-   /* Show standard status info */
-   getTime(tml, "%d-%m-%Y %R");
-   batCapacityNow=getSysInfo(sysfsBatteryCapacity);
-   powerNow=getSysInfo(sysfsBatteryPowerNow)/1000000;
-   net[0]='\0';
-   tmp[0]='\0';
-   pwr[0]='\0';
-   bat[0]='\0';
-
-   if (nlData->id>=0)
-      getNetwork(net, nlData, wStats);
-
-   if (sysfsThermalPath != NULL)
-      snprintf(tmp, MX_ELEMENT_CHARS, "tmp:%liC%c", getTmpInfo(sysfsThermalPath), si_separator);
-
-   if (powerNow>0)
-      snprintf(pwr, MX_ELEMENT_CHARS, "pwr:%liW%c", powerNow, si_separator);
-
-   if (batCapacityNow>15)
-      snprintf(bat, MX_ELEMENT_CHARS, "bat:%li%%%c", batCapacityNow, si_separator);
-   else {
-      if (batCapacityNow!=-1)
-         snprintf(bat, MX_ELEMENT_CHARS, "[!]bat:%li%%%c", batCapacityNow, si_separator);
-   }
+static void shmClose(void) {
+   if (shm==NULL)
+      return;
+   munmap(shm, sizeof(si_shm));
+   unlink(shmPath);   /* Readers keep their mapping, but the values are no longer updated */
+   shm=NULL;
+}
 
-   snprintf(sBuf, MX_STATUS_CHARS, "%s%s%s%s%s", net, tmp, pwr, bat, tml);
-   sBuf[MX_STATUS_CHARS-1]='\0';
+/* Append the unescaped "full_text" of the JSON block in line to b (the server's jsonEscape() output) */
+static void sockClientText(si_str *b, const char *line) {
+   const char *p=strstr(line, "\"full_text\":\"");
+   unsigned int c;
 
+   if (p==NULL)
+      return;
+   for (p+=13; *p!='\0' && *p!='"'; p++) {
+      if (*p=='\\' && p[1]=='u' && sscanf(p+2, "%4x", &c)==1) {
+         strPrintf(b, "%c", c);
+         p+=5;
+      }
+      else if (*p=='\\' && p[1]!='\0')
+         strAppend(b, ++p, 1);
+      else
+         strAppend(b, p, 1);
+   }
 }
 
-/* Get thermal path for cpu */
-int getThermalPath() {
-   int i;
-   char thermalType[16];   /* Store for thermal zone name */
-   char sysfsThermalPath[MX_PATH_LEN];  /* THERMAL_ZONE<n>/name */
-   FILE *thermalZone;
+/* --once against a -j server: it sends one block per line on connect. The status line is rebuilt from
+ * the full_text of the status blocks (the notification block is left out), joined by the separator.
+ */
+static int sockClientJson(int fd, char *buf, size_t size, ssize_t n) {
+   si_str line;
+   char *nl, *start=buf;
+   int blk=0, first=1;
+   ssize_t r;
 
-   for (i=0; i<9; i++) {
-      if (snprintf(sysfsThermalPath, MX_PATH_LEN, "%s%i/name", THERMAL_ZONE, i) < MX_PATH_LEN)
-         fprintf(stderr, "Checking thermal zone type: %s ... ", sysfsThermalPath);
-      else {
-         fprintf(stderr, "ERROR: getThermalPath: MX_PATH_LEN exceeded.");
-         break;
+   strInit(&line);
+   while (blk<blkCount) {
+      if ((nl=memchr(start, '\n', buf+n-start))==NULL) {   /* Partial line: keep it, read more */
+         memmove(buf, start, buf+n-start);
+         n-=start-buf;
+         start=buf;
+         if ((size_t)n>=size-1 || (r=read(fd, buf+n, size-1-n))<=0)
+            break;
+         n+=r;
+         continue;
       }
-      thermalZone=fopen(sysfsThermalPath, "r");
-      if (thermalZone==NULL) {
-         fprintf(stderr, "zone not found: temperature readout not available\n");
-         break;   /* No more zones */
-      }
-      thermalType[0]='\0';
-      fgets(thermalType, 15, thermalZone);
-      fclose(thermalZone);
-      fprintf(stderr, "%s\n", thermalType);
-      if (strstr(THERMAL_NAME, thermalType) != NULL) {
-         fprintf(stderr, "Matched: using %s\n", thermalType);
-         return i;
+      *nl='\0';
+      if (blk++<elStatusCount && strstr(start, "\"full_text\":\"\"")==NULL) {
+         if (!first)
+            strAppend(&line, &si_separator, 1);
+         sockClientText(&line, start);
+         first=0;
       }
+      start=nl+1;
    }
-   return -1;
+   strCat(&line, "\n");
+   return (write(STDOUT_FILENO, line.s, line.len)==(ssize_t)line.len) ? 0 : 1;
 }
 
-int dwlbSocketInit(long dwlb_ref, struct sockaddr_un *sock_address) {
-   char *xdgRunTimeDir;
-   int i=0, j=-1;
+/* Client mode (statusInfo --client): copy the status stream of a running statusInfo -s / --server to
+ * stdout, e.g. for tmux #() or sway status_command. With once set, only the current status line is
+ * printed, which makes a tmux status-interval refresh a connect and a copy.
+ */
+static int sockClient(const char *path, int once) {
+   struct sockaddr_un addr;
+   char buf[16384];
+   ssize_t n;
+   int fd, ret;
 
-   /* Establish socket and check connection to dwlb */
-   if (!(xdgRunTimeDir=getenv("XDG_RUNTIME_DIR"))) {
-      fprintf(stderr, "dwlbSocketInit: Could not retrieve XDG_RUNTIME_DIR\n");
-      return -1;
+   if (sockAddress(&addr, path)==-1)
+      return 1;
+   fd=socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+   if (fd==-1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))==-1) {
+      fprintf(stderr, "statusInfo: Could not connect to statusInfo server on %s: %s\n", addr.sun_path, strerror(errno));
+      return 1;
    }
-   sock_address->sun_family=AF_UNIX;
-   snprintf(sock_address->sun_path, sizeof (sock_address->sun_path), "%s/dwlb/dwlb-%li", xdgRunTimeDir, dwlb_ref);
 
-   fprintf(stderr, "Waiting for dwlb socket on %s\n", sock_address->sun_path);
-   for(i=0; j==-1 && i<10; i++) {
-      sleep(1);
-      j=dwlbSend(sock_address, "all", "status", "dwl");
+   while ((n=read(fd, buf, sizeof(buf)))>0) {
+      if (once && buf[0]=='{') {   /* Structured server */
+         ret=sockClientJson(fd, buf, sizeof(buf), n);
+         close(fd);
+         return ret;
+      }
+      if (once && memchr(buf, '\n', n)!=NULL)
+         n=(char *)memchr(buf, '\n', n)-buf+1;
+      if (write(STDOUT_FILENO, buf, n)!=n)
+         break;
+      if (once && buf[n-1]=='\n')
+         break;
    }
-   if (j==-1) {
-      fprintf(stderr, "dwlbSocketInit: Could not comminicate with dwlb on %s\n", sock_address->sun_path);
-      return -1;
+   close(fd);
+   return 0;
+}
+
+static int xorgSend(const char *status) {
+   setXorgBarText((char *)status);
+   return 0;
+}
+
+static int textSend(const char *status) {
+   printf("%s\n", status);
+   statSyscall(statSink+text);
+   fflush(stdout);   /* This is required for tmux */
+   return 0;
+}
+
+/* Structured output: the i3bar protocol requires the whole array of shown blocks on each update (the
+ * header and opening bracket are written at startup)
+ */
+static int textSendJson(unsigned int changed) {
+   int i, n=0;
+
+   printf("[");
+   for (i=0; i<blkCount; i++) {
+      if (blocks[i].shown)
+         printf("%s%s", (n++>0) ? "," : "", TEXT(blocks[i].json));
    }
-   xdgRunTimeDir=NULL;
+   printf("],\n");
+   statSyscall(statSink+text);
+   fflush(stdout);
+   return 0;
+}
+
+static int dwlbSendStatus(const char *status) {
+   return dwlbSend("all", "status", status);
+}
+
+static si_sink sinks[sinkCount] = {
+   /* status line, structured output */
+   [xorg] = { xorgSend },
+   [text] = { textSend,       textSendJson },
+   [dwlb] = { dwlbSendStatus },
+   [sock] = { sockSinkSend,   sockSinkSendJson },
+};
+
+/* Status is rendered once and written to every enabled sink. Output is skipped if status is identical
+ * to the last string written (e.g. a status refresh where nothing visible changed), which also saves
+ * X11 requests, dwlb connections and tmux redraws.
+ */
+static int sbOut(const char *status) {
+   struct timespec t;
+   size_t len=strlen(status);
+   int i, retVal=0;
+
+   if (textEqual(&lastOut, status, len))
+      return 0;
 
-   return 0;
+   for (i=0; i<sinkCount; i++) {
+      if (!sinks[i].enabled || (jsonOutput && sinks[i].sendJson!=NULL))
+         continue;
+      statStart(&t);
+      if (sinks[i].send(status)==-1)
+         retVal=-1;
+      statEnd(statSink+i, &t);
+   }
+   if (retVal==0)   /* Not delivered: sent again next time, even if unchanged */
+      textSet(&lastOut, status, len);
+   return retVal;
 }
 
-static int sbOut(int outputFunction, struct sockaddr_un *sock_address, char *status) {
-   int retVal=0;
+/* Structured output (-j): blocks are rendered from the elements and only the sinks supporting it are
+ * written to, and only if a block changed. Notifications are a block of their own rather than
+ * replacing the status, so the status blocks keep updating while one is shown.
+ */
+static int jsonOut(si_state *st) {
+   struct timespec t;
+   unsigned int changed;
+   int i, retVal=0;
 
-   switch (outputFunction) {
-      case xorg: setXorgBarText(status); break;
-      case text: printf("%s\n", status); break;
-      case dwlb: retVal=dwlbSend(sock_address, "all", "status", status); break;
-      default:
-         fprintf(stderr, "statusInfo: sbOut: ERROR: unknown outputFunction\n");
+   changed=jsonRender(st);
+   if (changed==0)
+      return 0;
+   for (i=0; i<sinkCount; i++) {
+      if (!sinks[i].enabled || sinks[i].sendJson==NULL)
+         continue;
+      statStart(&t);
+      if (sinks[i].sendJson(changed)==-1)
          retVal=-1;
-      break;
+      statEnd(statSink+i, &t);
    }
-   fflush(stdout);   /* This is required for tmux */
    return retVal;
 }
 
+/* Raw mixer values for the shared memory snapshot: one entry per mixer name */
+static void shmMixer(const char *name, int volL, int volR, int activeL, int activeR) {
+   si_shm *s;
+   si_shmMixer *m;
+   unsigned int i;
+
+   if ((s=shmBegin())==NULL)
+      return;
+   for (i=0; i<s->nMixers && strncmp(s->mixer[i].name, name, sizeof(m->name)-1)!=0; i++)
+      ;
+   if (i<SI_SHM_MIXERS) {
+      m=&s->mixer[i];
+      if (i==s->nMixers) {
+         s->nMixers++;
+         snprintf(m->name, sizeof(m->name), "%s", name);
+      }
+      m->volume[0]=volL;
+      m->volume[1]=volR;
+      m->active[0]=activeL;
+      m->active[1]=activeR;
+   }
+   shmEnd(s);
+}
+
 /* Only supports stereo (front left / right) channels */
 int mixer_elem_cb(snd_mixer_elem_t *elem, unsigned int mask) {
+   struct timespec t;
+   si_str volumeLevel;
+   si_mixerElem *m=&mixerElems[(intptr_t)snd_mixer_elem_get_callback_private(elem)];
    long min=0, max=1, volR=-1, volL=-1;
    int rR, rL, r;
    int activeL=-1, activeR=-1, masterL=-1, masterR=-1;
 
-   if ( ! mask & SND_CTL_EVENT_MASK_VALUE) {
-      printf("Not SND_CTL_EVENT_MASK_VALUE!\n");
+   if (mask==SND_CTL_EVENT_MASK_REMOVE) {   /* Element is freed on return */
+      m->ranged=0;
       return 0;
    }
+   if (!(mask & (SND_CTL_EVENT_MASK_VALUE | SND_CTL_EVENT_MASK_INFO)))
+      return 0;
+   statStart(&t);
 
    if (snd_mixer_selem_has_playback_switch(elem)) {
       rL=snd_mixer_selem_get_playback_switch(elem, SND_MIXER_SCHN_FRONT_LEFT, &activeL);
@@ -515,9 +3681,16 @@ int mixer_elem_cb(snd_mixer_elem_t *elem, unsigned int mask) {
       }
    }
    if (snd_mixer_selem_has_playback_volume(elem)) {
-      r = snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
-      if (r < 0)
-         fprintf(stderr, "snd_mixer_selem_get_playback_volume_range: %s\n", snd_strerror(r));
+      if (!m->ranged || (mask & SND_CTL_EVENT_MASK_INFO)) {
+         r = snd_mixer_selem_get_playback_volume_range(elem, &m->min, &m->max);
+         if (r < 0)
+            fprintf(stderr, "snd_mixer_selem_get_playback_volume_range: %s\n", snd_strerror(r));
+         m->ranged=(r>=0);
+      }
+      if (m->ranged) {
+         min=m->min;
+         max=m->max;
+      }
 
       rL=snd_mixer_selem_get_playback_volume(elem, SND_MIXER_SCHN_FRONT_LEFT, &volL);
       if (rL < 0)
@@ -538,27 +3711,265 @@ int mixer_elem_cb(snd_mixer_elem_t *elem, unsigned int mask) {
       masterL = 100 * volL / max;
    }
 
-   r=snprintf(volumeLevel, MX_STATUS_CHARS, "%s: %s%d%%", snd_mixer_selem_get_name(elem), (activeL==1) ? "": "!", masterL);
+   shmMixer(snd_mixer_selem_get_name(elem), masterL, masterR, activeL, activeR);
+   strInit(&volumeLevel);
+   strPrintf(&volumeLevel, "%s: %s%d%%", snd_mixer_selem_get_name(elem), (activeL==1) ? "": "!", masterL);
    if (masterL!=masterR || activeL!=activeR)
-      snprintf(volumeLevel+r, MX_STATUS_CHARS-r-1, ":%s%d%%", (activeR==1) ? "": "!", masterR);
+      strPrintf(&volumeLevel, ":%s%d%%", (activeR==1) ? "": "!", masterR);
+   textSet(&m->text, volumeLevel.s, volumeLevel.len);   /* Only the latest value is kept until notified */
+   m->changed=1;
+   statEnd(statMixer, &t);
+
+   return 0;
+}
+
+static int mixerEvent(si_state *st, si_source *src, uint32_t events);
+
+/* Open the alsa_hw_device mixer, set the callback of the alsa_monitor elements found and monitor
+ * its poll descriptors. Returns the number of poll descriptors, -1 on error (mixer not attached).
+ */
+static int mixerAttach(si_mixer *mx) {
+   snd_mixer_elem_t *elem;
+   snd_mixer_selem_id_t *id;
+   int i, ret;
+
+   mx->nFds=0;
+
+   /* Initialise the mixer handle (struct _snd_mixer); O_RDONLY is for reference and is not used by snd_mixer_open()
+    * The handle is allocated and needs to be freed. Returns -ENOMEM if calloc fails, otherwise returns 0.
+    */
+   ret=snd_mixer_open(&mx->handle, O_RDONLY);
+   if (ret < 0) {
+      fprintf(stderr, "snd_mixer_open: %s\n", snd_strerror(ret));
+      mx->handle=NULL;
+      return -1;
+   }
+   ret=snd_mixer_attach(mx->handle, cfg.alsaDevice);  /* Adds higher level control struct _snd_hctl for default control to the mixer slaves list */
+   if (ret < 0)
+      fprintf(stderr, "snd_mixer_attach: %s\n", snd_strerror(ret));
+   else {
+      ret=snd_mixer_selem_register(mx->handle, NULL, NULL);  /* For each slave in list, adds data to the mixer classes */
+      if (ret < 0)
+         fprintf(stderr, "snd_mixer_selem_register: %s\n", snd_strerror(ret));
+   }
+   if (ret >= 0) {
+      ret=snd_mixer_load(mx->handle);   /* Load and sort all mixer elements into the mixer elems for each snd_mixer_slave_t */
+      if (ret < 0)
+         fprintf(stderr, "snd_mixer_load: %s\n", snd_strerror(ret));
+   }
+   if (ret >= 0) {
+      ret=-1;
+      for (i=0; i<cfg.nAlsa; i++) {
+         snd_mixer_selem_id_alloca(&id);                    /* snd_mixer_find_selem() requires both name and id to be set */
+         snd_mixer_selem_id_set_name(id, cfg.alsaMonitor[i]);   /* Set name of mixer simple element (char name[60];) */
+         snd_mixer_selem_id_set_index(id, 0);               /* Set index of simple mixer element (unsigned int index;) */
+         elem=snd_mixer_find_selem(mx->handle, id);         /* Search the mixer elems list and return an element that matches BOTH name and id */
+         if (elem==NULL)
+            fprintf(stderr, "could not find mixer element %s\n", cfg.alsaMonitor[i]);
+         else {
+            snd_mixer_elem_set_callback(elem, mixer_elem_cb);  /* Set callback function for element; sets elem->snd_mixer_elem_callback_t; must return 0 on success otherwise a negative error code */
+            snd_mixer_elem_set_callback_private(elem, (void *)(intptr_t)i);   /* Index into mixerElems[] */
+            mixerElems[i].ranged=0;
+            mixer_elem_cb(elem, SND_CTL_EVENT_MASK_INFO);   /* Volume range and initial values: not a notification */
+            mixerElems[i].changed=0;
+            ret=0;
+         }
+      }
+   }
+   if (ret >= 0) {
+      /* Get file descriptors for the mixer control. The count of descriptors is:
+       * 1 for hw controls, corresponding to relevant device via open() or rsm_open_device()
+       * 1 for shm controls, corresponding to aserver socket via socket(PF_LOCAL, SOCK_STREAM, 0); addr->sun_family = AF_LOCAL;
+       * may be greater than 1 for external plugins loaded from /usr/lib/alsa-lib which return a poll descriptor array
+       *    From pipewire-alsa sources, libasound_module_ctl_pipewire.so will return a single file descriptor.
+       * 1 for remapped controls: in this case the file descriptor can change, which may make the FD returned here invalid.
+       * Events in fd is set to POLLIN|POLLERR|POLLNVAL.
+       */
+      ret=snd_mixer_poll_descriptors_count(mx->handle);
+      if (ret > MX_MIXER_FDS) {
+         fprintf(stderr, "snd_mixer_poll_descriptors: %d poll descriptors, only %d polled: volume events may not be reported.\n", ret, MX_MIXER_FDS);
+         ret=MX_MIXER_FDS;
+      }
+      if (ret > 0)
+         ret=snd_mixer_poll_descriptors(mx->handle, mx->pfds, ret);
+      if (ret <= 0) {
+         fprintf(stderr, "snd_mixer_poll_descriptors: %s: mixer events won't be reported.\n", (ret<0) ? snd_strerror(ret) : "no descriptors");
+         ret=-1;
+      }
+   }
+   if (ret < 0) {
+      snd_mixer_close(mx->handle);   /* Close the mixer and free all resources */
+      mx->handle=NULL;
+      return -1;
+   }
+   mx->nFds=ret;
+   for (i=0; i<mx->nFds; i++)   /* Level triggered: the plugin decides when its descriptors are drained */
+      mx->src[i]=evAdd(mx->pfds[i].fd, mx->pfds[i].events, mixerEvent, (void *)(intptr_t)i);
+   return ret;
+}
+
+static void mixerDetach(si_mixer *mx) {
+   int i;
 
+   for (i=0; i<mx->nFds; i++)
+      evDel(mx->src[i]);
+   if (mx->handle!=NULL)
+      snd_mixer_close(mx->handle);
+   mx->handle=NULL;
+   mx->nFds=0;
+   for (i=0; i<LENGTH(mixerElems); i++)
+      mixerElems[i].ranged=0;
+}
+
+/* Handle events on a mixer poll descriptor: the element callbacks set mixerElems[]. An error on the
+ * descriptors (sound card removed) detaches the mixer.
+ */
+static int mixerEvent(si_state *st, si_source *src, uint32_t events) {
+   si_mixer *mx=&st->mixer;
+   unsigned short revents=0;
+   int i, ret;
+
+   if (mx->handle==NULL)
+      return 0;
+   for (i=0; i<mx->nFds; i++)   /* poll() and epoll event bits are the same */
+      mx->pfds[i].revents=(i==(intptr_t)src->data) ? events : 0;
+   ret=snd_mixer_poll_descriptors_revents(mx->handle, mx->pfds, mx->nFds, &revents);
+   if (ret < 0) {
+      fprintf(stderr, "snd_mixer_poll_descriptors_revents: %s\n", snd_strerror(ret));
+      return 0;
+   }
+   if (revents & (POLLERR | POLLNVAL | POLLHUP)) {
+      fprintf(stderr, "statusInfo: WARNING: mixer closed: volume events won't be reported until the sound card is back.\n");
+      mixerDetach(mx);
+   }
+   else if (revents & POLLIN) {
+      /* For event type SND_CTL_EVENT_ELEM:
+       *   Read events and handle certain operations (SNDRV_CTL_EVENT_MASK_REMOVE - element removed, SNDRV_CTL_EVENT_MASK_ADD - element added) internally
+       *   Call callback for SNDRV_CTL_EVENT_MASK_VALUE and SNDRV_CTL_EVENT_MASK_INFO events
+       * Returns: 0 if not a SND_CTL_EVENT_ELEM event or success (event handled), or callback not defined.
+       *        < 0 on error (element not found, calloc failed for new element, error adding new element)
+       *          n: from user callback. NOTE: alsa-lib does not check the return value, however callback should return 0 on success otherwise a negative error code (include/mixer.h).
+       */
+      ret=snd_mixer_handle_events(mx->handle);
+      if (ret < 0)
+         fprintf(stderr, "snd_mixer_handle_events: %s\n", snd_strerror(ret));
+   }
+   for (i=0; i<LENGTH(mixerElems); i++) {
+      if (mixerElems[i].changed)
+         st->notifyPending|=notifyAlsa;
+   }
    return 0;
 }
 
+/* Sound card hot plug (udev "sound" subsystem, see udevActions[]): a card registered ("change" once all
+ * its devices are created) attaches the mixer if it is not attached, a card removed re-attaches it in
+ * case alsa_hw_device was on that card. Returns 1 if the mixer was attached.
+ */
+static int mixerHotplug(si_mixer *mx, struct udev_device *dev, int subsys, int action) {
+   const char *sysname=udev_device_get_sysname(dev);
+
+   if (subsys<0 || strcmp(udevActions[subsys].subSystem, "sound")!=0 || sysname==NULL || strncmp(sysname, "card", 4)!=0)
+      return 0;
+   if (action==udevRemove)
+      mixerDetach(mx);
+   else if (mx->handle!=NULL || action==udevOther)
+      return 0;
+   return mixerAttach(mx)>0;
+}
+
+/* Subsystems are resolved to their udevActions[] index once per event with a hash table built by
+ * udevInit(): one string compare instead of one for each udevActions[] entry.
+ */
+#define UDEV_HASH_SIZE (2*LENGTH(udevActions)+1)   /* Always a free slot: a lookup ends at an empty one */
+static signed char udevSubsystems[UDEV_HASH_SIZE];   /* udevActions[] index+1, 0 if empty (open addressing) */
+_Static_assert(LENGTH(udevActions)<32, "udevActions[] (config.h): at most 31 entries, cfg.udev is a bit mask");
+
+/* Returns the udevActions[] index of subsystem, -1 if not in udevActions[] (e.g. hwmon) */
+static int udevSubsystemId(const char *subsystem) {
+   uint32_t h;
+   int i;
+
+   if (subsystem==NULL)
+      return -1;
+   for (h=strHash(subsystem)%UDEV_HASH_SIZE; udevSubsystems[h]!=0; h=(h+1)%UDEV_HASH_SIZE) {
+      i=udevSubsystems[h]-1;
+      if (strcmp(udevActions[i].subSystem, subsystem)==0)
+         return i;
+   }
+   return -1;
+}
+
+/* Add udevActions[i] to the subsystem table */
+static void udevSubsystemAdd(int i) {
+   uint32_t h;
+
+   for (h=strHash(udevActions[i].subSystem)%UDEV_HASH_SIZE; udevSubsystems[h]!=0; h=(h+1)%UDEV_HASH_SIZE)
+      ;
+   udevSubsystems[h]=i+1;
+}
+
+static int udevActionId(const char *action) {
+   if (action==NULL)
+      return udevOther;
+   switch (action[0]) {
+      case 'a':
+         return (strcmp(action, "add")==0) ? udevAdd : udevOther;
+      case 'r':
+         return (strcmp(action, "remove")==0) ? udevRemove : udevOther;
+      case 'c':
+         return (strcmp(action, "change")==0) ? udevChange : udevOther;
+   }
+   return udevOther;
+}
+
+#ifdef UDEV_TAG
+/* Returns 1 if a device has tag: the tag filter is only used if the udev rules are installed */
+static int udevTagged(struct udev *udevCtx, const char *tag) {
+   struct udev_enumerate *e;
+   int found=0;
+
+   if ((e=udev_enumerate_new(udevCtx))==NULL)
+      return 0;
+   if (udev_enumerate_add_match_tag(e, tag)>=0 && udev_enumerate_scan_devices(e)>=0)
+      found=(udev_enumerate_get_list_entry(e)!=NULL);
+   udev_enumerate_unref(e);
+   return found;
+}
+#endif
+
 static struct udev_monitor *udevInit(struct udev *udevCtx) {
    struct udev_monitor *udevMon;
    int i=0, j=0;
 
+   memset(udevSubsystems, 0, sizeof(udevSubsystems));
+   if ((cfg.udev & ((1u<<LENGTH(udevActions))-1))==0)
+      return NULL;   /* All disabled in the configuration */
    udevMon=udev_monitor_new_from_netlink(udevCtx, "udev");
    if (udevMon==NULL)
       return NULL;
 
    for (i=0; i<LENGTH(udevActions); i++) {
-      if (udev_monitor_filter_add_match_subsystem_devtype(udevMon, udevActions[i].subSystem, NULL)<0)
+      if (!(cfg.udev & 1u<<i))
+         continue;
+      if (udev_monitor_filter_add_match_subsystem_devtype(udevMon, udevActions[i].subSystem, NULL)<0) {
          fprintf(stderr, "udevInit(): Failed to add filter for %s\n", udevActions[i].subSystem);
-      else
-         j++;
+         continue;
+      }
+      udevSubsystemAdd(i);
+      j++;
+   }
+
+#ifdef UDEV_TAG
+   /* The tag is matched by the kernel socket filter libudev installs: events of other devices of these
+    * subsystems (battery changes) do not wake us. Batteries and sensors have their own monitor (sysDevDrain()).
+    */
+   if (j>0 && udevTagged(udevCtx, UDEV_TAG)) {
+      if (udev_monitor_filter_add_match_tag(udevMon, UDEV_TAG)<0)
+         fprintf(stderr, "udevInit(): Failed to add filter for tag %s\n", UDEV_TAG);
    }
+   else if (j>0)
+      fprintf(stderr, "udevInit(): no device tagged %s (see README): events of all devices are received\n", UDEV_TAG);
+#endif
 
    if (j==0) {
       fprintf(stderr, "udevInit(): Failed to add any filters: aborting.\n");
@@ -576,135 +3987,538 @@ static struct udev_monitor *udevInit(struct udev *udevCtx) {
 /* NOTE: It says here: http://cholla.mmto.org/computers/usb/OLD/tutorial_usbloger.html
  *       that "All the strings which come from sysfs are Unicode UTF-8. It is an error to assume that they are ASCII."
  */
-static int udevStatus(char *sBuf, char udevDisplayInfo[MX_NUMBER_ELEMENTS][MX_ELEMENT_CHARS], struct udev_device *dev) {
-   const char *udevSubsystem=udev_device_get_subsystem(dev);
-   const char *udevAction=udev_device_get_action(dev);
-   int i, j, ret=-1;
-   char separator=' ';
-//   const char *udevPath=udev_device_get_syspath(dev);
+static int udevStatus(si_str *sBuf, si_text udevDisplayInfo[LENGTH(udevActions)+1], struct udev_device *dev, int subsys, int action) {
+   struct timespec t;
+   int i, ret=-1;
+   si_str info;
 
-   if (udevSubsystem==NULL)
+   if (subsys<0)
       return -1;
+   statStart(&t);
+
+   if (action==udevChange) {
+      strInit(&info);
+      ret=udevActions[subsys].func(dev, &info);
+      if (ret==0)
+         textSet(&udevDisplayInfo[subsys], info.s, info.len);
+   }
+   else
+      udevAttrForget(udev_device_get_syspath(dev));   /* Added or removed: static attributes may differ */
+
+   if (ret==-1) {
+      strInit(&info);
+      strPrintf(&info, "%s: %s: %s", udevActions[subsys].subSystem, udev_device_get_sysname(dev), udev_device_get_action(dev));
+      textSet(&udevDisplayInfo[LENGTH(udevActions)], info.s, info.len);
+   }
+
+   for (i=0; i<LENGTH(udevActions)+1; i++)
+      strAppend(sBuf, TEXT(udevDisplayInfo[i]), udevDisplayInfo[i].len);
+   statEnd(statUdev, &t);
+   return 0;
+}
+
+/* Edge triggered: udev_monitor_receive_device() returns NULL once the socket is drained (EAGAIN).
+ * Events only update the latest values here, the notification is output by notifyEmit().
+ * EPOLLERR is a socket overrun (ENOBUFS): reading the error clears it, the queued events are drained
+ * and what the lost events could have changed is resynced: the cached static attributes are forgotten
+ * and a mixer that is not attached is attached again (sound card added meanwhile).
+ */
+static int udevEvent(si_state *st, si_source *src, uint32_t events) {
+   struct udev_monitor *udevMon=src->data;
+   struct udev_device *dev;
+   si_str sBuf;
+   socklen_t len=sizeof(int);
+   int i, subsys, action, err=0;
+
+   if (events & EPOLLERR) {
+      if (getsockopt(src->fd, SOL_SOCKET, SO_ERROR, &err, &len)==-1)
+         err=errno;
+      fprintf(stderr, "udevEvent: udev monitor: %s: resyncing\n", strerror(err));
+      udevAttrForget(NULL);
+   }
+   for (i=0; (dev=udev_monitor_receive_device(udevMon))!=NULL; i++) {   /* All events queued */
+      subsys=udevSubsystemId(udev_device_get_subsystem(dev));
+      action=udevActionId(udev_device_get_action(dev));
+      mixerHotplug(&st->mixer, dev, subsys, action);
+      if (subsys>=0) {
+         strInit(&sBuf);
+         udevStatus(&sBuf, st->udevDisplayInfo, dev, subsys, action);
+         if (sBuf.len>0)
+            st->notifyPending|=notifyUdev;
+      }
+      udev_device_unref(dev);
+   }
+   if (i==0 && errno!=EAGAIN)
+      fprintf(stderr, "udev_monitor_receive_device() failed\n");
+   if ((events & EPOLLERR) && st->mixer.handle==NULL)
+      mixerAttach(&st->mixer);
+   return 0;
+}
+
+/* (Re)open the notification monitor for the udevActions[] enabled in the configuration */
+static void udevOpen(si_state *st) {
+   int i;
+
+   evDel(st->udevSrc);   /* Before the fd is closed */
+   if (st->udevMon!=NULL)
+      udev_monitor_unref(st->udevMon);
+   st->udevSrc=NULL;
+   st->udevMon=(st->udevCtx!=NULL) ? udevInit(st->udevCtx) : NULL;
+   if (st->udevMon!=NULL)
+      st->udevSrc=evAdd(udev_monitor_get_fd(st->udevMon), EPOLLIN|EPOLLET, udevEvent, st->udevMon);
+   else if (cfg.udev!=0)
+      fprintf(stderr, "statusInfo: WARNING: error initializing udev: udev events won't be reported.\n");
+   for (i=0; i<LENGTH(udevActions); i++) {
+      if (!(cfg.udev & 1u<<i))
+         textSet(&st->udevDisplayInfo[i], "", 0);
+   }
+}
+
+/* Configuration file: one "key = value" per line, '#' starts a comment. Values may be quoted ("...")
+ * to keep leading or trailing spaces; lists are separated by commas. Keys not given keep their config.h
+ * value.
+ */
+enum { cfgLong, cfgString, cfgChar, cfgNames, cfgAlsa, cfgUdev, cfgHistory };
+static const struct {
+   const char *key;
+   int type;
+   size_t offset;
+   long min;   /* cfgLong: lowest value accepted */
+} cfgKeys[]={
+   /* key,                    type,       field,                                   min */
+   { "notify_timeout",        cfgLong,    offsetof(si_config, notifyTimeout),      0 },
+   { "coalesce_window",       cfgLong,    offsetof(si_config, coalesceWindow),     0 },
+   { "temp_interval",         cfgLong,    offsetof(si_config, interval[timerTmp]), 100 },
+   { "battery_interval",      cfgLong,    offsetof(si_config, interval[timerBat]), 100 },
+   { "proc_interval",         cfgLong,    offsetof(si_config, interval[timerProc]), 100 },
+   { "wifi_station_interval", cfgLong,    offsetof(si_config, interval[timerNet]), 100 },
+   { "wifi_station_timeout",  cfgLong,    offsetof(si_config, wifiStationTimeout), 1 },
+   { "psi_show",              cfgLong,    offsetof(si_config, psiShow),            0 },
+   { "battery_low",           cfgLong,    offsetof(si_config, batteryLow),         0 },
+   { "policy_interval",       cfgLong,    offsetof(si_config, interval[timerPolicy]), 100 },
+   { "policy_battery",        cfgLong,    offsetof(si_config, policyBattery),      1 },
+   { "policy_low_battery",    cfgLong,    offsetof(si_config, policyLowBattery),   1 },
+   { "policy_dim",            cfgLong,    offsetof(si_config, policyDim),          1 },
+   { "policy_dim_level",      cfgLong,    offsetof(si_config, policyDimLevel),     0 },
+   { "separator",             cfgChar,    offsetof(si_config, separator),          0 },
+   { "clock_format",          cfgString,  offsetof(si_config, clockFormat),        0 },
+   { "thermal_name",          cfgNames,   offsetof(si_config, thermalName),        0 },
+   { "temp_input",            cfgString,  offsetof(si_config, tempInput),          0 },
+   { "alsa_hw_device",        cfgString,  offsetof(si_config, alsaDevice),         0 },
+   { "alsa_monitor",          cfgAlsa,    offsetof(si_config, alsaMonitor),        0 },
+   { "udev",                  cfgUdev,    offsetof(si_config, udev),               0 },
+   { "history",               cfgHistory, offsetof(si_config, history),            0 },
+};
+
+static void configDefaults(si_config *c) {
+   int i;
+
+   memset(c, 0, sizeof(*c));
+   c->interval[timerTmp]=TEMP_INTERVAL;
+   c->interval[timerBat]=BATTERY_INTERVAL;
+   c->interval[timerNet]=WIFI_STATION_INTERVAL;
+   c->interval[timerProc]=PROC_INTERVAL;
+   c->interval[timerPolicy]=POLICY_INTERVAL;
+   c->notifyTimeout=NOTIFY_TIMEOUT;
+   c->coalesceWindow=COALESCE_WINDOW;
+   c->wifiStationTimeout=WIFI_STATION_TIMEOUT;
+   c->psiShow=PSI_SHOW;
+   c->batteryLow=BATTERY_LOW;
+   c->policyBattery=POLICY_BATTERY;
+   c->policyLowBattery=POLICY_LOW_BATTERY;
+   c->policyDim=POLICY_DIM;
+   c->policyDimLevel=POLICY_DIM_LEVEL;
+   c->separator=SEPARATOR;
+   snprintf(c->clockFormat, MX_CFG_VALUE, "%s", CLOCK_FORMAT);
+   snprintf(c->thermalName, sizeof(c->thermalName), "%s", THERMAL_NAME);
+   snprintf(c->tempInput, MX_CFG_VALUE, "%s", TEMP_INPUT);
+   snprintf(c->alsaDevice, MX_CFG_VALUE, "%s", ALSA_HW_DEVICE);
+   for (i=0; i<MX_ALSA_ELEMS && i<LENGTH(si_alsaMonitor) && si_alsaMonitor[i]!=NULL; i++)
+      snprintf(c->alsaMonitor[c->nAlsa++], MX_CFG_VALUE, "%s", si_alsaMonitor[i]);
+   c->udev=~0u;
+   c->history=HISTORY_SHOW;
+}
+
+/* Parse one value into c. Returns NULL on success, otherwise the error */
+static const char *configValue(si_config *c, int key, char *value) {
+   char *field=(char *)c+cfgKeys[key].offset, *item, *end;
+   size_t len=strlen(value), used=0;
+   long v;
+   int i;
+
+   switch (cfgKeys[key].type) {
+      case cfgLong:
+         v=strtol(value, &end, 10);
+         if (end==value || *end!='\0')
+            return "not a number";
+         if (v<cfgKeys[key].min)
+            return "value too small";
+         *(long *)field=v;
+         return NULL;
+      case cfgString:
+         if (len>=MX_CFG_VALUE)
+            return "value too long";
+         memcpy(field, value, len+1);
+         return NULL;
+      case cfgChar:
+         if (len!=1)
+            return "one character expected";
+         *field=value[0];
+         return NULL;
+   }
 
-   if (strcoll("change", udevAction)==0) {
-      for (i=0; i<LENGTH(udevActions) && i<MX_NUMBER_ELEMENTS; i++) {
-         if (strcoll(udevActions[i].subSystem, udevSubsystem)==0)
-            ret=udevActions[i].func(dev, udevDisplayInfo[i]);
+   /* Lists */
+   if (cfgKeys[key].type==cfgAlsa)
+      c->nAlsa=0;
+   else if (cfgKeys[key].type==cfgUdev)
+      c->udev=0;
+   else if (cfgKeys[key].type==cfgHistory)
+      c->history=0;
+   for (item=strtok(value, ","); item!=NULL; item=strtok(NULL, ",")) {
+      while (*item==' ' || *item=='\t')
+         item++;
+      for (len=strlen(item); len>0 && (item[len-1]==' ' || item[len-1]=='\t'); len--)
+         item[len-1]='\0';
+      if (len==0)
+         continue;
+      switch (cfgKeys[key].type) {
+         case cfgNames:
+            if (used+len+2>sizeof(c->thermalName))
+               return "too many names";
+            memcpy(field+used, item, len);
+            used+=len;
+            field[used++]='\n';
+            break;
+         case cfgAlsa:
+            if (c->nAlsa>=MX_ALSA_ELEMS || len>=MX_CFG_VALUE)
+               return "too many or too long mixer element names";
+            memcpy(c->alsaMonitor[c->nAlsa++], item, len+1);
+            break;
+         case cfgUdev:
+            for (i=0; i<LENGTH(udevActions) && strcmp(udevActions[i].subSystem, item)!=0; i++)
+               ;
+            if (i==LENGTH(udevActions))
+               return "subsystem not in udevActions[] (config.h)";
+            c->udev|=1u<<i;
+            break;
+         case cfgHistory:
+            if (strcmp(item, "spark")==0)
+               c->history|=historySpark;
+            else if (strcmp(item, "range")==0)
+               c->history|=historyRange;
+            else if (strcmp(item, "none")!=0)
+               return "spark, range or none expected";
+            break;
       }
    }
+   if (cfgKeys[key].type==cfgNames)
+      field[used]='\0';
+   return NULL;
+}
 
-   if (ret==-1)
-      snprintf(udevDisplayInfo[MX_NUMBER_ELEMENTS-1], MX_ELEMENT_CHARS, "%s: %s: %s%c", udevSubsystem, udev_device_get_sysname(dev), udevAction, separator);
+/* Load the configuration file at path over the config.h values. A missing file gives the config.h
+ * values unless it is required (given with -c); lines in error, and lines longer than the line buffer,
+ * are reported and ignored. Returns -1 if the file can not be read.
+ */
+static int configLoad(const char *path, int required, si_config *c) {
+   char line[512], *key, *value, *end;
+   const char *err;
+   int lineNo=0, i, ch;
+   FILE *f;
 
-   j=MX_STATUS_CHARS;
-   for (i=0; i<MX_NUMBER_ELEMENTS && j>MX_ELEMENT_CHARS; i++) {
-      strncat(sBuf, udevDisplayInfo[i], MX_ELEMENT_CHARS);
-      j-=strlen(udevDisplayInfo[i]);
+   configDefaults(c);
+   if (path[0]=='\0')
+      return 0;
+   if ((f=fopen(path, "r"))==NULL) {
+      if (errno==ENOENT && !required)
+         return 0;
+      fprintf(stderr, "statusInfo: configuration %s: %s\n", path, strerror(errno));
+      return -1;
    }
+   while (fgets(line, sizeof(line), f)!=NULL) {
+      lineNo++;
+      if (strchr(line, '\n')==NULL && !feof(f)) {
+         fprintf(stderr, "statusInfo: configuration %s:%i: line longer than %i characters\n", path, lineNo, (int)sizeof(line)-2);
+         while ((ch=fgetc(f))!=EOF && ch!='\n')
+            ;
+         continue;
+      }
+      for (key=line; *key==' ' || *key=='\t'; key++)
+         ;
+      if (*key=='#' || *key=='\n' || *key=='\0')
+         continue;
+      if ((value=strchr(key, '='))==NULL) {
+         fprintf(stderr, "statusInfo: configuration %s:%i: \"key = value\" expected\n", path, lineNo);
+         continue;
+      }
+      for (end=value; end>key && (end[-1]==' ' || end[-1]=='\t'); end--)
+         ;
+      *end='\0';
+      for (value++; *value==' ' || *value=='\t'; value++)
+         ;
+      for (end=value+strlen(value); end>value && (end[-1]=='\n' || end[-1]==' ' || end[-1]=='\t'); end--)
+         ;
+      *end='\0';
+      if (end-value>=2 && value[0]=='"' && end[-1]=='"') {
+         end[-1]='\0';
+         value++;
+      }
+      for (i=0; i<LENGTH(cfgKeys) && strcmp(cfgKeys[i].key, key)!=0; i++)
+         ;
+      if (i==LENGTH(cfgKeys))
+         err="unknown key";
+      else
+         err=configValue(c, i, value);
+      if (err!=NULL)
+         fprintf(stderr, "statusInfo: configuration %s:%i: %s: %s\n", path, lineNo, key, err);
+   }
+   fclose(f);
    return 0;
 }
 
+/* Values used as they are: set on load and on reload */
+static void configSet(void) {
+   int i;
+
+   for (i=0; i<timerCount; i++) {
+      if (timers[i].interval>0)
+         timers[i].interval=cfg.interval[i]*(timers[i].scaled ? policy.scale : 1);
+   }
+   si_separator=cfg.separator;
+}
+
+/* Rebuild the modules whose configuration changed from old: reschedule timers, re-rank the sensors,
+ * re-attach the mixer, reopen the udev monitor, re-render the elements, re-evaluate the refresh
+ * policy. Returns 1 if the status needs to be output.
+ */
+static int configApply(si_state *st, const si_config *old) {
+   int i, refresh=0;
+
+   configSet();
+   for (i=0; i<timerCount; i++) {
+      if (cfg.interval[i]!=old->interval[i] && timers[i].armed)
+         schedArm(&timers[i], timers[i].interval);
+   }
+   if (strcmp(cfg.clockFormat, old->clockFormat)!=0 && st->clock.fd>=0) {
+      clockPeriod(&st->clock);
+      clockArm(&st->clock);
+      refresh|=updateClock(st);
+   }
+   if ((strcmp(cfg.thermalName, old->thermalName)!=0 || strcmp(cfg.tempInput, old->tempInput)!=0) && sysDevRank(&st->devs))
+      refresh|=updateTmp(st);
+   if (strcmp(cfg.alsaDevice, old->alsaDevice)!=0 || cfg.nAlsa!=old->nAlsa || memcmp(cfg.alsaMonitor, old->alsaMonitor, sizeof(cfg.alsaMonitor))!=0) {
+      mixerDetach(&st->mixer);
+      for (i=0; i<LENGTH(mixerElems); i++) {
+         textSet(&mixerElems[i].text, "", 0);
+         mixerElems[i].changed=0;
+      }
+      mixerAttach(&st->mixer);
+   }
+   if (cfg.udev!=old->udev)
+      udevOpen(st);
+   if (cfg.separator!=old->separator)
+      refresh=1;   /* Only the composition changes: see getStatusInfo() */
+   if (cfg.psiShow!=old->psiShow)
+      refresh|=updateProc(st);
+   if (cfg.history!=old->history)
+      refresh|=updateTmp(st) | updateBat(st) | updateNet(st);
+   if (cfg.batteryLow!=old->batteryLow)
+      refresh|=updateBat(st);
+   return refresh | policyUpdate(st);   /* Scale of the new intervals, thresholds */
+}
+
+/* SIGHUP: reload the configuration file. An unreadable file keeps the current configuration */
+static int configReload(si_state *st) {
+   si_config old=cfg, c;
+
+   if (configLoad(cfgPath, cfgRequired, &c)==-1)
+      return 0;
+   cfg=c;
+   fprintf(stderr, "statusInfo: INFO: configuration reloaded\n");
+   return configApply(st, &old);
+}
+
+/* SIGHUP: reload the configuration; SIGUSR1: dump stats; SIGINT, SIGTERM: exit */
+static int signalEvent(si_state *st, si_source *src, uint32_t events) {
+   struct signalfd_siginfo *siginfo=src->data;
+
+   if (read(src->fd, siginfo, sizeof(*siginfo))!=sizeof(*siginfo))
+      fprintf(stderr, "Error reading signal fd\n");
+   else if (siginfo->ssi_signo==SIGUSR1) {
+      statsDump();
+      return 0;
+   }
+   else if (siginfo->ssi_signo==SIGHUP)
+      return configReload(st);
+   return -1;
+}
+
+/* After each dispatch: the low priority monitor (sysDevDrain()) and, if the power state may have changed,
+ * the refresh policy. Returns 1 if the status needs to be output
+ */
+static int sysDevUpdate(si_state *st) {
+   int refresh=0;
+
+   if (sysDevDrain(&st->devs))
+      refresh|=updateBat(st) | updateTmp(st);
+   if (st->devs.powerState)
+      refresh|=policyUpdate(st);
+   return refresh;
+}
+
+/* Optional path argument after option i: any argument that is not an option. With numbers set, a
+ * decimal number is the dwlb socket number, not a path.
+ */
+static const char *optPath(int argc, char **argv, int i, int numbers) {
+   if (i+1>=argc || argv[i+1][0]=='-' || argv[i+1][0]=='\0')
+      return NULL;
+   if (numbers && strspn(argv[i+1], "0123456789")==strlen(argv[i+1]))
+      return NULL;
+   return argv[i+1];
+}
+
 int main(int argc, char **argv) {
    int exit_request=0;
-   int ret, nfd=0;
-   char sBuf[MX_STATUS_CHARS];
-   char sysfsThermalPath[MX_PATH_LEN];
-   char sysfsBatteryCapacity[MX_PATH_LEN];
-   char sysfsBatteryPowerNow[MX_PATH_LEN];
+   int ret, refresh;
+   si_state st;
    int i;
    long dwlbSocketId=-1;
-   struct sockaddr_un sock_address;
-   int outputFunction=none;
-   si_nlData nlData;
-   si_wStats wStats;
-   char udevDisplayInfo[MX_NUMBER_ELEMENTS][MX_ELEMENT_CHARS];
-   struct udev *udevCtx=NULL;
-   struct udev_monitor *udevMon=NULL;
-   struct pollfd fds[3];
-   int udev_fd=-1, signal_fd=-1;
+   int nSinks=0;
+   const char *dir, *path;
+   int signal_fd=-1, timer_fd=-1;
    sigset_t sigset;
    struct signalfd_siginfo siginfo;
-   struct udev_device *dev;
-
-   snd_mixer_elem_t *elem=NULL;
-   snd_mixer_t *mixerp=NULL;
-   snd_mixer_selem_id_t *id=NULL;
 
-   int timeout=1000;
-
-   if (MX_NUMBER_ELEMENTS<1) {
-      fprintf(stderr, "statusInfo: ERROR: MX_NUMBER_ELEMENTS < 1. Adjust config.h and recompile.\n");
-      return 1;
+   /* Client mode first: no other option may take effect (bind the server socket, open X, create shm) */
+   for (i=1; i<argc; i++) {
+      if (strcmp(argv[i], "--client")==0 || strcmp(argv[i], "--once")==0)
+         return sockClient(optPath(argc, argv, i, 0), strcmp(argv[i], "--once")==0);
    }
-   if (MX_NUMBER_ELEMENTS < LENGTH(udevActions))
-      fprintf(stderr, "statusInfo: WARNING: MX_NUMBER_ELEMENTS smaller than number of defined udevActions.\n Some udev events may not be reported.\n");
 
-   if (argc>=2) {
-      if (argv[1][0]=='-') {
-         if (argv[1][1]=='t') {
-            fprintf(stderr, "statusInfo: INFO: output to text\n");
-            outputFunction=text;
-         }
-         else {
-            fprintf(stderr, "Usage: %s <-t || socket number of dwlb>\n", argv[0]);
-            fprintf(stderr, "If dwlb socket number is given, status info is written to the specified dwlb socket\n");
-            fprintf(stderr, "If dwlb socket number is not given, status info is written xorg root window name (for dwm)\n");
-            fprintf(stderr, "If X display not found or -t is given, status info is written out as text (for sway or tmux)\n");
+   for (i=1; i<argc; i++) {
+      if (strcmp(argv[i], "-t")==0) {
+         fprintf(stderr, "statusInfo: INFO: output to text\n");
+         sinks[text].enabled=1;
+      }
+      else if (strcmp(argv[i], "-x")==0) {
+         dpy=XOpenDisplay(NULL);
+         if (dpy==NULL) {
+            fprintf(stderr, "statusInfo: ERROR: Could not open X display.\n");
             return 1;
          }
+         fprintf(stderr, "statusInfo: INFO: output to xorg\n");
+         xorgInit();
+         sinks[xorg].enabled=1;
       }
-      else { /* Try dwlb socket */
-         dwlbSocketId=atol(argv[1]);
-         if (dwlbSocketId<0) {
-            fprintf(stderr, "statusInfo: ERROR: Invalid socket ID for dwlb socket.\n");
+      else if (strcmp(argv[i], "-j")==0)
+         jsonOutput=1;
+      else if (strcmp(argv[i], "--stats")==0) {
+         statsOn=1;
+         clock_gettime(CLOCK_MONOTONIC, &statSince);
+      }
+      else if (strcmp(argv[i], "-m")==0) {
+         if (shmInit()==-1)
             return 1;
-         }
-         if (dwlbSocketInit(dwlbSocketId, &sock_address)==-1)
+      }
+      else if (strcmp(argv[i], "-c")==0 && i+1<argc) {
+         snprintf(cfgPath, MX_PATH_LEN, "%s", argv[++i]);
+         cfgRequired=1;
+      }
+      else if (strcmp(argv[i], "-s")==0 || strcmp(argv[i], "--server")==0) {
+         path=optPath(argc, argv, i, 1);
+         i+=(path!=NULL);
+         if (sockSinkInit(path)==-1)
+            return 1;
+         sinks[sock].enabled=1;
+      }
+      else if (argv[i][0]>='0' && argv[i][0]<='9') { /* Try dwlb socket */
+         dwlbSocketId=atol(argv[i]);
+         if (dwlbSocketInit(dwlbSocketId)==-1)
             return 1;
-         outputFunction=dwlb;
+         sinks[dwlb].enabled=1;
          fprintf(stderr, "statusInfo: INFO: output to dwlb\n");
       }
+      else {
+         fprintf(stderr, "Usage: %s [-t] [-x] [-s [socket path]] [-j] [-m] [-c config file] [--stats] [socket number of dwlb]\n", argv[0]);
+         fprintf(stderr, "Any number of outputs can be given; status info is collected once and written to all of them:\n");
+         fprintf(stderr, "   -t    write status info out as text (for sway or tmux)\n");
+         fprintf(stderr, "   -x    write status info to the xorg root window name (for dwm)\n");
+         fprintf(stderr, "   -s, --server    publish status info on a UNIX socket (default $XDG_RUNTIME_DIR/statusInfo.sock): one line per update\n");
+         fprintf(stderr, "   -j    text and socket outputs are i3bar / swaybar protocol JSON; socket subscribers get changed blocks only\n");
+         fprintf(stderr, "   -m    also publish the raw status values in shared memory ($XDG_RUNTIME_DIR/%s, see statusInfo-shm.h)\n", SI_SHM_FILE);
+         fprintf(stderr, "   -c    configuration file (default $XDG_CONFIG_HOME/statusInfo/config): overrides config.h, reloaded on SIGHUP\n");
+         fprintf(stderr, "   --stats  time and count each collector and sink: dumped on SIGUSR1 and on exit\n");
+         fprintf(stderr, "Or run as a client of a statusInfo server:\n");
+         fprintf(stderr, "   --client [socket path]   copy the status stream to stdout (e.g. sway status_command)\n");
+         fprintf(stderr, "   --once [socket path]     print the current status line and exit (e.g. tmux #())\n");
+         fprintf(stderr, "   If dwlb socket number is given, status info is written to the specified dwlb socket\n");
+         fprintf(stderr, "If no output is given status info is written to the xorg root window name, or as text if X display not found\n");
+         return 1;
+      }
+   }
+   for (i=0; i<sinkCount; i++)
+      nSinks+=sinks[i].enabled;
+
+   if (cfgPath[0]=='\0') {
+      if ((dir=getenv("XDG_CONFIG_HOME"))!=NULL && dir[0]!='\0')
+         snprintf(cfgPath, MX_PATH_LEN, "%s/statusInfo/config", dir);
+      else if ((dir=getenv("HOME"))!=NULL)
+         snprintf(cfgPath, MX_PATH_LEN, "%s/.config/statusInfo/config", dir);
    }
-   else { /* Try xorg */
+   if (configLoad(cfgPath, cfgRequired, &cfg)==-1) {
+      if (cfgRequired)
+         return 1;
+      configDefaults(&cfg);
+   }
+   configSet();
+
+   if (nSinks==0 && jsonOutput)
+      sinks[text].enabled=1;
+   else if (nSinks==0) { /* Try xorg */
       dpy=XOpenDisplay(NULL);
       if (dpy!=NULL) {
          fprintf(stderr, "statusInfo: INFO: output to xorg\n");
-         outputFunction=xorg;
+         xorgInit();
+         sinks[xorg].enabled=1;
       }
       else { /* Default to text output */
          fprintf(stderr, "statusInfo: INFO: default output to text\n");
-         outputFunction=text;
+         sinks[text].enabled=1;
       }
    }
 
+   if (jsonOutput && sinks[text].enabled) {
+      printf("{\"version\":1}\n[\n");
+      fflush(stdout);
+   }
+
+   if (evInit()==-1)
+      return 1;
+   memset(&siginfo, 0, sizeof(siginfo));
+
    /* Setup udev event monitoring */
-   udevCtx=udev_new();
-   if (udevCtx!=NULL)
-      udevMon=udevInit(udevCtx);
-   if (udevMon!=NULL)
-      udev_fd=udev_monitor_get_fd(udevMon);
-   if (udev_fd < 0)
-      fprintf(stderr, "statusInfo: WARNING: error initializing udev: udev events won't be reported.\n");
+   memset(st.udevDisplayInfo, 0, sizeof(st.udevDisplayInfo));
+   st.udevMon=NULL;
+   st.udevSrc=NULL;
+   st.udevCtx=udev_new();
+   udevOpen(&st);
 
-   fds[0].fd=udev_fd;   /* This will be -1 on error and poll will ignore this fd */
-   fds[0].events=POLLIN|POLLERR|POLLNVAL;
-   nfd++;
+   /* Setup rtnetlink for network link and address changes */
+   if (rtnlInit(&st.rtnl) < 0)
+      fprintf(stderr, "statusInfo: WARNING: error initializing rtnetlink: network status won't be reported.\n");
+   evAdd(st.rtnl.fd, EPOLLIN|EPOLLET, rtnlSourceEvent, NULL);   /* rtnlEvent() reads until EAGAIN; modules that fail to initialise have fd -1: not monitored */
 
    /* Setup netlink for wifi stats */
-   if (init_nl80211(&nlData, &wStats) < 0)
+   if (init_nl80211(&st.nlData, &st.wStats) < 0)
       fprintf(stderr, "statusInfo: WARNING: error initializing netlink 802.11\n");
+   if (st.nlData.evSocket!=NULL)
+      evAdd(nl_socket_get_fd(st.nlData.evSocket), EPOLLIN, nlEvent, NULL);
+   if (st.nlData.id>=0)
+      evAdd(nl_socket_get_fd(st.nlData.socket), EPOLLIN, nlQueryEvent, NULL);
 
-   /* Build battery paths */
-   /* TODO: not all systems report power_now, some have current_now */
-   snprintf(sysfsBatteryCapacity, MX_PATH_LEN, "%s/%s/capacity", POWER_SUPPLY, BATTERY_NAME);
-   snprintf(sysfsBatteryPowerNow, MX_PATH_LEN, "%s/%s/power_now", POWER_SUPPLY, BATTERY_NAME);
-
-   fprintf(stderr, "Check path for sysfsBatteryCapacity: %s\n", getSysInfo(sysfsBatteryCapacity)==-1 ? "Failed" : "OK");
-   fprintf(stderr, "Check path for sysfsBatteryPowerNow: %s\n", getSysInfo(sysfsBatteryPowerNow)==-1 ? "Failed" : "OK");
-
-   i=getThermalPath();
-   if (i>-1)
-      snprintf(sysfsThermalPath, MX_PATH_LEN, "%s%i/%s", THERMAL_ZONE, i, TEMP_INPUT);
+   /* Batteries, adapters, temperature sensors and the backlight */
+   sysDevScan(&st.devs, st.udevCtx);
+   procInit(&st.proc);
 
    /* Signal handler */
    ret=sigemptyset(&sigset);
@@ -712,6 +4526,7 @@ int main(int argc, char **argv) {
       ret+=sigaddset(&sigset, SIGINT);
       ret+=sigaddset(&sigset, SIGTERM);
       ret+=sigaddset(&sigset, SIGHUP);
+      ret+=sigaddset(&sigset, SIGUSR1);
    }
    if (ret==0)
       ret=sigprocmask(SIG_SETMASK, &sigset, NULL);
@@ -721,151 +4536,135 @@ int main(int argc, char **argv) {
       fprintf(stderr, "Unable to initialise signal handling\n");
       exit_request=1;
    }
-   fds[1].fd=signal_fd;
-   fds[1].events=POLLIN|POLLERR|POLLNVAL;
-   nfd++;
+   evAdd(signal_fd, EPOLLIN, signalEvent, &siginfo);
 
-   /* Initialise the mixerp struct _snd_mixer (mixer handle); O_RDONLY is for reference and is not used by snd_mixer_open()
-    * mixerp is allocated and needs to be freed. Returns -ENOMEM if calloc fails, otherwise returns 0.
-    */
-   ret=snd_mixer_open(&mixerp, O_RDONLY);
-   if (ret < 0)
-      fprintf(stderr, "snd_mixer_open: %s\n", snd_strerror(ret));
-   else
-      ret=snd_mixer_attach(mixerp, ALSA_HW_DEVICE);  /* Adds higher level control struct _snd_hctl for default control to mixerp->slaves list in mixerp struct */
+   /* Slow probes: started after the signal mask is set, which the thread inherits */
+   if (COLLECTOR_THREAD && collectorInit()==0)
+      evAdd(collector.resFd, EPOLLIN|EPOLLET, collectorEvent, NULL);
 
-   if (ret < 0)
-      fprintf(stderr, "snd_mixer_attach: %s\n", snd_strerror(ret));
-   else {
-      ret=snd_mixer_selem_register(mixerp, NULL, NULL);  /* For each slave in list, adds data to mixerp->classes */
-      if (ret < 0)
-         fprintf(stderr, "snd_mixer_selem_register: %s\n", snd_strerror(ret));
-      else {
-         ret=snd_mixer_load(mixerp);   /* Load and sort all mixer elements into mixerp->elems for each snd_mixer_slave_t in mixerp. */
-         if (ret < 0)
-            fprintf(stderr, "snd_mixer_load: %s\n", snd_strerror(ret));
-         else {
-            ret=-1;
-            for (i=0; i<8 && si_alsaMonitor[i]!=NULL; i++) {
-               //printf("%s\n", si_alsaMonitor[i]);
-               snd_mixer_selem_id_alloca(&id);                    /* snd_mixer_find_selem() requires both name and id to be set */
-               snd_mixer_selem_id_set_name(id, si_alsaMonitor[i]);   /* Set name of mixer simple element (char name[60];) */
-               snd_mixer_selem_id_set_index(id, 0);               /* Set index of simple mixer element (unsigned int index;) */
-               elem=snd_mixer_find_selem(mixerp, id);             /* Search mixerp->elems list and return an element that matches BOTH name and id */
-               if (elem==NULL)
-                  fprintf(stderr, "could not find mixer element %s\n", si_alsaMonitor[i]);
-               else {
-                  snd_mixer_elem_set_callback(elem, mixer_elem_cb);  /* Set callback function for element; sets elem->snd_mixer_elem_callback_t; must return 0 on success otherwise a negative error code */
-                  ret=0;
-               }
-            }
-         }
-      }
+   /* Alsa mixer: if the sound card is not there yet it is attached when it appears */
+   mixerAttach(&st.mixer);
+
+   /* Scheduler timer */
+   timer_fd=timerfd_create(CLOCK_BOOTTIME, TFD_NONBLOCK|TFD_CLOEXEC);
+   if (timer_fd<0) {
+      perror("timerfd_create");
+      exit_request=1;
    }
+   evAdd(timer_fd, EPOLLIN|EPOLLET, schedEvent, NULL);
 
-   if (ret>=0) {
-      /* Get file descriptors for the mixer control. The count of descriptors is:
-       * ret=1 for hw controls, corresponding to relevant device via open() or rsm_open_device()
-       * ret=1 for shm controls, corresponding to aserver socket via socket(PF_LOCAL, SOCK_STREAM, 0); addr->sun_family = AF_LOCAL;
-       * ret may be greater than 1 for external plugins loaded from /usr/lib/alsa-lib which return a poll descriptor array
-       *    From pipewire-alsa sources, libasound_module_ctl_pipewire.so will return a single file descriptor.
-       * ret=1 for remapped controls: in this case the file descriptor can change, which may make the FD returned here invalid.
-       * Events in fd is set to POLLIN|POLLERR|POLLNVAL.
-       */
-      ret=snd_mixer_poll_descriptors_count(mixerp);
-      if (ret!=1)
-         fprintf(stderr, "snd_mixer_poll_descriptors: more than 1 poll descriptor: check alsa plugins. Volume events may not be reported.\n");
-      ret=snd_mixer_poll_descriptors(mixerp, &fds[2], 1);
-      if (ret < 0) {
-         fds[2].fd=-1;
-         fprintf(stderr, "snd_mixer_poll_descriptors: %s: mixer events won't be reported.\n", snd_strerror(ret));
+   if (clockInit(&st.clock)<0)
+      fprintf(stderr, "statusInfo: WARNING: clock timer not available: clock won't be updated.\n");
+   evAdd(st.clock.fd, EPOLLIN|EPOLLET, clockEvent, NULL);
+
+   if (dpy!=NULL)
+      evAdd(ConnectionNumber(dpy), EPOLLIN, xorgEvent, NULL);
+   evAdd(sockSink.fd, EPOLLIN, sockSinkAccept, NULL);   /* One connection accepted per event */
+
+   /* Render all elements once, then each module refreshes on its own timer */
+   asleepNs=sleepTime();
+   memset(&st.tmpHistory, 0, sizeof(st.tmpHistory));
+   memset(&st.pwrHistory, 0, sizeof(st.pwrHistory));
+   memset(st.element, 0, sizeof(st.element));
+   memset(st.composed, 0, sizeof(st.composed));
+   st.composedSeparator=0;
+   memset(&st.statusLine, 0, sizeof(st.statusLine));
+   memset(&st.notifyText, 0, sizeof(st.notifyText));
+   st.notifying=0;
+   st.notifyPending=0;
+   updateClock(&st);
+   endNotify(&st);
+   for (i=0; i<timerCount; i++) {
+      if (timers[i].interval>0) {
+         timers[i].func(&st);
+         schedArm(&timers[i], timers[i].interval);
       }
-      else
-         nfd++;
    }
+   updateNet(&st);
+   refresh=1;
 
    while(!exit_request) {
-      fds[0].revents = 0;
-      fds[1].revents = 0;
-      fds[2].revents = 0;
-      ret=poll(fds, nfd, timeout);
-      if (ret <0) break;
-      if (ret >0) {
-         if (fds[0].revents & (POLLERR | POLLNVAL) || fds[1].revents & (POLLERR | POLLNVAL) || fds[2].revents & (POLLERR | POLLNVAL)) {
-            fprintf(stderr, "Poll error\n");
+      arenaReset(&frame);   /* Strings of the previous iteration are no longer used */
+      if (refresh && !policy.blanked) {
+         getStatusInfo(&st);
+         if (!st.notifying && sbOut(TEXT(st.statusLine))==-1)
             break;
-         }
-         sBuf[0]='\0';
-         volumeLevel[0]='\0';
-         /* Handle events on file desriptors */
-         if (fds[0].revents & POLLIN) {
-            dev=udev_monitor_receive_device(udevMon);
-            if (dev != NULL) {
-               udevStatus(sBuf, udevDisplayInfo, dev);
-               udev_device_unref(dev);
-            }
-            else
-               fprintf(stderr, "udev_monitor_receive_device() failed\n");
-         }
-
-         if (fds[1].revents & POLLIN) {
-            if (read(signal_fd, &siginfo, sizeof(siginfo)) != sizeof(siginfo)) {
-               fprintf(stderr, "Error reading signal fd\n");
-            }
+         if (jsonOutput && jsonOut(&st)==-1)
             break;
-         }
-
-         /* For a single FD, snd_mixer_poll_descriptors_revents() just returns (fds[2]->revents & (POLLIN|POLLERR|POLLNVAL)) */
-         if (fds[2].revents & POLLIN) {
-            //ret=snd_mixer_poll_descriptors_revents(mixerp, &fds[2], 1, &mixer_revents);
-
-            /* For event type SND_CTL_EVENT_ELEM:
-             *   Read events and handle certain operations (SNDRV_CTL_EVENT_MASK_REMOVE - element removed, SNDRV_CTL_EVENT_MASK_ADD - element added) internally
-             *   Call callback for SNDRV_CTL_EVENT_MASK_VALUE and SNDRV_CTL_EVENT_MASK_INFO events
-             * Returns: 0 if not a SND_CTL_EVENT_ELEM event or success (event handled), or callback not defined. 
-             *        < 0 on error (element not found, calloc failed for new element, error adding new element)
-             *          n: from user callback. NOTE: alsa-lib does not check the return value, however callback should return 0 on success otherwise a negative error code (include/mixer.h).
-             */
-            
-            ret=snd_mixer_handle_events(mixerp);
-            if (ret < 0)
-               fprintf(stderr, "snd_mixer_handle_events: %s\n", snd_strerror(ret));
-            else
-               snprintf(sBuf, MX_STATUS_CHARS, "%s", volumeLevel);
-         }
-
-         if (sBuf[0]!='\0') {
-            if (sbOut(outputFunction, &sock_address, sBuf)==-1)
-               break;
-            timeout=NOTIFY_TIMEOUT;
-            continue;
-         }
       }
-      /* ret == 0: poll timed out - refresh status info */
-      for (i=0; i<MX_NUMBER_ELEMENTS; i++)
-         udevDisplayInfo[i][0]='\0';
-
-      getStatusInfo(sBuf, sysfsBatteryCapacity, sysfsBatteryPowerNow, sysfsThermalPath, &nlData, &wStats);
-      if (sbOut(outputFunction, &sock_address, sBuf)==-1)
+      schedUpdate(timer_fd);
+      refresh=evDispatch(&st);
+      if (refresh==-1)
          break;
 
-      timeout=STATUS_TIMEOUT;
+      refresh|=sysDevUpdate(&st);
+
+      /* The first event after a quiet COALESCE_WINDOW is output at once, the rest of a burst when the
+       * window ends (notifyFlush())
+       */
+      if (st.notifyPending && !timers[timerCoalesce].armed) {
+         ret=notifyEmit(&st);
+         if (ret==-1)
+            break;
+         refresh|=ret;
+      }
    }
 
    fprintf(stderr, "\nExit: %s received. Closing status info...\n", strsignal(siginfo.ssi_signo));
    if (signal_fd>=0)
       close(signal_fd);
 
-   udev_monitor_unref(udevMon);
-   udev_unref(udevCtx);
-   if (nlData.id>=0) {
-      nl_cb_put(nlData.wlanStats_cb);  /* This decreases the ref count for the cb: src: libnl: handlers.c (e.g. https://www.infradead.org/~tgr/libnl/doc/api/handlers_8c_source.html) */
-      nl_close(nlData.socket);
-      nl_socket_free(nlData.socket);
+   udev_monitor_unref(st.udevMon);
+   udev_unref(st.udevCtx);
+   if (st.nlData.evSocket!=NULL) {
+      nl_cb_put(st.nlData.ev_cb);
+      nl_close(st.nlData.evSocket);
+      nl_socket_free(st.nlData.evSocket);
+   }
+   if (st.nlData.id>=0) {
+      nlmsg_free(st.nlData.stationMsg);
+      nl_cb_put(st.nlData.wlanStats_cb);  /* This decreases the ref count for the cb: src: libnl: handlers.c (e.g. https://www.infradead.org/~tgr/libnl/doc/api/handlers_8c_source.html) */
+      nl_close(st.nlData.socket);
+      nl_socket_free(st.nlData.socket);
+   }
+   if (st.rtnl.fd>=0)
+      close(st.rtnl.fd);
+   collectorClose();   /* Before ethCache, which it uses */
+   if (statsOn)
+      statsDump();
+   if (ethCache.fd>=0)
+      close(ethCache.fd);
+   sysDevClose(&st.devs);
+   procClose(&st.proc);
+   if (timer_fd>=0)
+      close(timer_fd);
+   if (st.clock.fd>=0)
+      close(st.clock.fd);
+   mixerDetach(&st.mixer);
+   sbOut("Status Bar Closed");
+   if (dpy!=NULL)
+      XCloseDisplay(dpy);  /* Flushes the last update */
+   dwlbClose();
+   sockSinkClose();
+   if (epollFd>=0)
+      close(epollFd);
+   shmClose();
+   for (i=0; i<elCount; i++)
+      textFree(&st.element[i].text);
+   for (i=0; i<LENGTH(st.udevDisplayInfo); i++)
+      textFree(&st.udevDisplayInfo[i]);
+   for (i=0; i<blkCount; i++)
+      textFree(&blocks[i].json);
+   for (i=0; i<LENGTH(mixerElems); i++)
+      textFree(&mixerElems[i].text);
+   for (i=0; i<MX_UDEV_ATTRS; i++) {
+      textFree(&udevAttrs[i].path);
+      textFree(&udevAttrs[i].value);
    }
-   /* Close the mixer and free all resources */ 
-   snd_mixer_close(mixerp);
-   sbOut(outputFunction, &sock_address, "Status Bar Closed");
+   textFree(&st.statusLine);
+   textFree(&st.notifyText);
+   textFree(&lastOut);
+   arenaFree(&frame);
    return 0;
 }
 